@@ -0,0 +1,262 @@
+#include "allocator.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <intrin.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// Origins of buffers
+typedef enum Alloc_Kind
+{
+	ALLOC_HEAP,	// Block of malloc()
+	ALLOC_MAPPED	// Pages mapped from the system
+} Alloc_Kind;
+
+// Bookkeeping stored right before every buffer
+typedef struct Alloc_Header
+{
+	void *base;	// Start of the allocated block
+	size_t length;	// Length of mapped blocks in bytes
+	Alloc_Kind kind;
+} Alloc_Header;
+
+// Whether explicit huge pages are worth trying, cleared after a failure.
+// Threads allocate at the same time, so it is only accessed atomically,
+// see _alloc_try_explicit() and _alloc_no_explicit().
+long volatile alloc_explicit = 1;
+
+void *_alloc_heap(size_t, bool);
+void *_alloc_pages(size_t);
+void *_alloc_place(void*, size_t, char*, Alloc_Kind);
+bool _alloc_try_explicit();
+void _alloc_no_explicit();
+
+/*
+	Function: buffer_alloc
+	-----------------------
+	Allocates a buffer aligned to ALLOC_ALIGN bytes. Buffers of at least
+	ALLOC_HUGE_MIN bytes are mapped from the system: explicit huge pages
+	are used when some are reserved, otherwise pages aligned to huge
+	pages are advised for transparent huge pages. Buffers come from the
+	heap when the system refuses both.
+
+	Parameters:
+	size - size in bytes
+	zero - whether the buffer is filled with zeros
+
+	Returns:
+	aligned buffer, or NULL when memory runs out
+*/
+void *buffer_alloc(size_t size, bool zero)
+{
+	void *result = NULL;
+
+	if (size >= ALLOC_HUGE_MIN) {
+		// Mapped pages are zero already
+		result = _alloc_pages(size);
+	}
+	if (result == NULL) {
+		result = _alloc_heap(size, zero);
+	}
+
+	return result;
+}
+
+/*
+	Function: buffer_free
+	----------------------
+	Releases a buffer of buffer_alloc().
+
+	Parameters:
+	buffer - buffer to be released, may be NULL
+*/
+void buffer_free(void *buffer)
+{
+	Alloc_Header *header;
+
+	if (buffer == NULL) {
+		return;
+	}
+
+	header = (Alloc_Header*)buffer - 1;
+	if (header->kind == ALLOC_HEAP) {
+		free(header->base);
+	}
+	else {
+#ifdef _WIN32
+		VirtualFree(header->base, 0, MEM_RELEASE);
+#else
+		munmap(header->base, header->length);
+#endif
+	}
+}
+
+/*
+	Function: _alloc_heap
+	----------------------
+	Internal function. Allocates an aligned buffer inside a heap block.
+
+	Parameters:
+	size - size in bytes
+	zero - whether the buffer is filled with zeros
+
+	Returns:
+	aligned buffer, or NULL when memory runs out
+*/
+void *_alloc_heap(size_t size, bool zero)
+{
+	size_t length = size + sizeof(Alloc_Header) + ALLOC_ALIGN - 1;
+	char *base = (char*)malloc(length);
+	char *start;
+
+	if (base == NULL) {
+		return NULL;
+	}
+	if (zero) {
+		memset(base, 0, length);
+	}
+
+	// Leaves room for the header before the aligned buffer
+	start = base + sizeof(Alloc_Header);
+	start += (ALLOC_ALIGN - (uintptr_t)start % ALLOC_ALIGN) % ALLOC_ALIGN;
+	return _alloc_place(base, length, start, ALLOC_HEAP);
+}
+
+/*
+	Function: _alloc_pages
+	-----------------------
+	Internal function. Maps a buffer from pages of the system, which
+	start zero filled.
+
+	Parameters:
+	size - size in bytes
+
+	Returns:
+	aligned buffer, or NULL when the system refuses to map pages
+*/
+void *_alloc_pages(size_t size)
+{
+	// The first line of the first page holds the header
+	size_t length = (size + ALLOC_ALIGN + ALLOC_HUGE_PAGE - 1) /
+		ALLOC_HUGE_PAGE * ALLOC_HUGE_PAGE;
+#ifdef _WIN32
+	size_t large = GetLargePageMinimum();
+	void *base;
+
+	// Large pages need the "Lock pages in memory" privilege
+	if (_alloc_try_explicit() && (large > 0)) {
+		size_t span = (size + ALLOC_ALIGN + large - 1) / large * large;
+
+		base = VirtualAlloc(NULL, span,
+			MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (base != NULL) {
+			return _alloc_place(base, span, (char*)base + ALLOC_ALIGN,
+				ALLOC_MAPPED);
+		}
+		_alloc_no_explicit();
+	}
+	base = VirtualAlloc(NULL, length, MEM_RESERVE | MEM_COMMIT,
+		PAGE_READWRITE);
+	if (base == NULL) {
+		return NULL;
+	}
+
+	return _alloc_place(base, length, (char*)base + ALLOC_ALIGN,
+		ALLOC_MAPPED);
+#else
+	char *base;
+	char *start;
+
+#ifdef MAP_HUGETLB
+	// Explicit huge pages only exist when they were reserved
+	if (_alloc_try_explicit()) {
+		base = (char*)mmap(NULL, length, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (base != (char*)MAP_FAILED) {
+			return _alloc_place(base, length, base + ALLOC_ALIGN,
+				ALLOC_MAPPED);
+		}
+		_alloc_no_explicit();
+	}
+#endif
+
+	// Transparent huge pages only back ranges aligned to huge pages
+	length += ALLOC_HUGE_PAGE;
+	base = (char*)mmap(NULL, length, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == (char*)MAP_FAILED) {
+		return NULL;
+	}
+	start = base + (ALLOC_HUGE_PAGE - (uintptr_t)base % ALLOC_HUGE_PAGE) %
+		ALLOC_HUGE_PAGE;
+#ifdef MADV_HUGEPAGE
+	madvise(start, length - (start - base), MADV_HUGEPAGE);
+#endif
+
+	return _alloc_place(base, length, start + ALLOC_ALIGN, ALLOC_MAPPED);
+#endif
+}
+
+/*
+	Function: _alloc_place
+	-----------------------
+	Internal function. Writes the header right before a buffer.
+
+	Parameters:
+	base - allocated block
+	length - length of the block in bytes
+	buffer - aligned buffer in the block, with room for the header
+		before it
+	kind - origin of the block
+
+	Returns:
+	the buffer
+*/
+void *_alloc_place(void *base, size_t length, char *buffer, Alloc_Kind kind)
+{
+	Alloc_Header *header = (Alloc_Header*)buffer - 1;
+
+	header->base = base;
+	header->length = length;
+	header->kind = kind;
+
+	return buffer;
+}
+
+/*
+	Function: _alloc_try_explicit
+	------------------------------
+	Internal function. Reads whether explicit huge pages are still worth
+	trying.
+
+	Returns:
+	false once the system refused explicit huge pages
+*/
+bool _alloc_try_explicit()
+{
+#ifdef _WIN32
+	return _InterlockedOr(&alloc_explicit, 0) != 0;
+#else
+	return __sync_fetch_and_or(&alloc_explicit, 0) != 0;
+#endif
+}
+
+/*
+	Function: _alloc_no_explicit
+	-----------------------------
+	Internal function. Stops trying explicit huge pages after the system
+	refused them.
+*/
+void _alloc_no_explicit()
+{
+#ifdef _WIN32
+	_InterlockedExchange(&alloc_explicit, 0);
+#else
+	__sync_lock_test_and_set(&alloc_explicit, 0);
+#endif
+}
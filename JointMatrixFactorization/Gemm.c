@@ -0,0 +1,936 @@
+#include "gemm.h"
+#include "simd.h"
+#include "threadpool.h"
+#include "kernels.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <string.h>
+#include <assert.h>
+
+// Multiplies on the calling thread, see _gemm_serial()
+typedef void (*Gemm_Func)(bool, bool, const Matrix*, const Matrix*, double,
+	Matrix*);
+
+typedef struct Gemm_Tiles
+{
+	Gemm_Func func;	// Multiplication of one tile
+	bool transA;
+	bool transB;
+	const Matrix *a;	// Operands of all products of a batch
+	const Matrix *b;
+	double beta;
+	Matrix *c;
+	int rows;		// Rows of a tile
+	int cols;		// Columns of a tile
+	int colTiles;	// Tiles in a row of C
+	int tiles;		// Tiles of one product
+} Gemm_Tiles;
+
+typedef struct Syrk_Parts
+{
+	const Matrix *a;
+	bool trans;
+	double *partial;	// Partial triangles of chunks of A
+} Syrk_Parts;
+
+typedef struct Syrk_Lanes
+{
+	const Matrix *a;	// Batch of matrices A
+	bool trans;
+	int count;	// Matrices in the batch
+	int n;	// Size of products
+	int k;	// Longest inner dimension
+	int chunks;	// Chunks of SYRK_KB of the longest inner dimension
+	double *partial;	// Interleaved partial triangles of lane groups
+} Syrk_Lanes;
+
+void _gemm_parallel(Gemm_Func, bool, bool, int, const Matrix*,
+	const Matrix*, double, Matrix*);
+void _gemm_serial(bool, bool, const Matrix*, const Matrix*, double, Matrix*);
+void _gemm_blocked(bool, bool, const Matrix*, const Matrix*, double, Matrix*,
+	bool);
+void _gemm_rows_serial(bool, bool, const Matrix*, const Matrix*, double,
+	Matrix*);
+void _gemm_dots_serial(bool, bool, const Matrix*, const Matrix*, double,
+	Matrix*);
+void _gemm_tile(void*, int, int);
+void _syrk_chunk(void*, int, int);
+void _syrk_lanes(void*, int, int);
+void _syrk_interleave(const Syrk_Lanes*, int, int, int, double*);
+void _gemm_pack_a(const Matrix*, bool, int, int, int, int, double*);
+void _gemm_pack_b(const Matrix*, bool, int, int, int, int, double*);
+void _gemm_gather(const Matrix*, size_t, size_t, int, double*);
+void _gemm_scale(Matrix*, double);
+
+/*
+	Function: gemm
+	---------------
+	Blocked matrix multiplication. Calculates C = op(A)op(B) + beta * C,
+	where op() transposes its operand when the flag is set. Transposed
+	operands are read in place by the packing routines.
+
+	Parameters:
+	transA - whether A is transposed
+	transB - whether B is transposed
+	a - matrix A
+	b - matrix B
+	beta - scaling of original C. When it is 0, C is only written.
+	c - result matrix
+*/
+void gemm(bool transA, bool transB, const Matrix *a, const Matrix *b,
+	double beta, Matrix *c)
+{
+	_gemm_parallel(_gemm_serial, transA, transB, 1, a, b, beta, c);
+}
+
+/*
+	Function: gemm_rows
+	--------------------
+	Multiplication without packing for thin products, C = op(A)B + beta
+	* C. Every row of C is combined from rows of B with coefficients
+	from op(A), so it suits products with few columns of op(A) (rank-k
+	updates) or few rows of C. B is walked in blocks of GEMM_ROWS_KB rows
+	and GEMM_ROWS_NB columns, which are reused by all rows of C.
+
+	Parameters:
+	transA - whether A is transposed
+	a - matrix A
+	b - matrix B
+	beta - scaling of original C. When it is 0, C is only written.
+	c - result matrix
+*/
+void gemm_rows(bool transA, const Matrix *a, const Matrix *b, double beta,
+	Matrix *c)
+{
+	_gemm_parallel(_gemm_rows_serial, transA, false, 1, a, b, beta, c);
+}
+
+/*
+	Function: gemm_dots
+	--------------------
+	Multiplication without packing for products with few columns,
+	C = A transpose(B) + beta * C. Every entry of C is a dot product of
+	a row of A and a row of B, so both operands are read along rows.
+
+	Parameters:
+	a - matrix A
+	b - matrix B
+	beta - scaling of original C. When it is 0, C is only written.
+	c - result matrix
+*/
+void gemm_dots(const Matrix *a, const Matrix *b, double beta, Matrix *c)
+{
+	_gemm_parallel(_gemm_dots_serial, false, true, 1, a, b, beta, c);
+}
+
+/*
+	Function: gemm_batch
+	---------------------
+	Batched multiplication. Calculates C[i] = op(A[i])op(B[i]) +
+	beta * C[i] for all products of a batch in one parallel loop. All
+	products have the same shape, and all of them are multiplied by the
+	kernels of one path. Tiles of every product are tasks of the same
+	loop, so a batch of small products still keeps all threads busy.
+
+	Parameters:
+	path - kernels chosen for the shape, Strassen products are multiplied
+		blocked
+	transA - whether A matrices are transposed
+	transB - whether B matrices are transposed
+	count - number of products
+	a - matrices A
+	b - matrices B
+	beta - scaling of original C matrices
+	c - result matrices
+*/
+void gemm_batch(Multiply_Path path, bool transA, bool transB, int count,
+	const Matrix *a, const Matrix *b, double beta, Matrix *c)
+{
+	Gemm_Func func = _gemm_serial;
+
+	if ((path == PATH_RANK_K) || ((path == PATH_PANEL) && !transB)) {
+		func = _gemm_rows_serial;
+	}
+	else if (path == PATH_PANEL) {
+		func = _gemm_dots_serial;
+	}
+
+	_gemm_parallel(func, transA, transB, count, a, b, beta, c);
+}
+
+/*
+	Function: syrk
+	---------------
+	Symmetric rank-k product. Calculates the lower triangle of
+	C = op(A) transpose(op(A)), where op() transposes A when the flag is
+	set. Entries above the diagonal are not always written. Large
+	products are split into block rows of SYRK_NB rows, and each block
+	row is only multiplied up to the diagonal by gemm(), which skips
+	nearly half of the work. Small products, such as Gram matrices of the
+	group dimension, run the blocked kernel without the register tiles
+	above the diagonal. Their long inner dimension is split into chunks
+	of SYRK_KB that are multiplied in parallel into partial triangles.
+
+	Parameters:
+	trans - whether A is transposed
+	a - matrix A
+	c - result matrix
+*/
+void syrk(bool trans, const Matrix *a, Matrix *c)
+{
+	int n = c->rows;
+	int k = trans ? a->rows : a->cols;
+	// Chunks have fixed size, so the result does not depend on the
+	// thread number
+	int chunks = (k + SYRK_KB - 1) / SYRK_KB;
+	Syrk_Parts parts;
+
+	if (n > SYRK_SMALL) {
+		for (int i0 = 0; i0 < n; i0 += SYRK_NB) {
+			int nb = (n - i0 < SYRK_NB) ? n - i0 : SYRK_NB;
+			// Block row of op(A), and all rows of op(A) up to its end
+			Matrix rows = trans ? matrix_view(a, 0, i0, k, nb) :
+				matrix_view(a, i0, 0, nb, k);
+			Matrix left = trans ? matrix_view(a, 0, 0, k, i0 + nb) :
+				matrix_view(a, 0, 0, i0 + nb, k);
+			Matrix part = matrix_view(c, i0, 0, nb, i0 + nb);
+
+			gemm(trans, !trans, &rows, &left, 0, &part);
+		}
+		return;
+	}
+	if (chunks <= 1) {
+		_gemm_blocked(trans, !trans, a, a, 0, c, true);
+		return;
+	}
+
+	parts.a = a;
+	parts.trans = trans;
+	parts.partial = (double*)pool_scratch(SCRATCH_PARTIAL,
+		(size_t)chunks * n * n * sizeof(double));
+
+	parallel_for(chunks, _syrk_chunk, &parts);
+	for (int i = 0; i < n; ++i) {
+		double *rowC = MATRIX_ROW(*c, i);
+		for (int j = 0; j <= i; ++j) {
+			rowC[j] = parts.partial[(size_t)i * n + j];
+			for (int t = 1; t < chunks; ++t) {
+				rowC[j] += parts.partial[((size_t)t * n + i) * n + j];
+			}
+		}
+	}
+}
+
+/*
+	Function: syrk_batch
+	---------------------
+	Batched symmetric rank-k product. Calculates the lower triangles of
+	C[i] = op(A[i]) transpose(op(A[i])) for all matrices of a batch.
+	Products must have the same size, but their inner dimensions may
+	differ. Small products are interleaved by SIMD_LANES matrices, so
+	that one vector holds the same entry of several products and no
+	lane is wasted on tiles larger than the product. Chunks of SYRK_KB of
+	the inner dimension are multiplied in parallel into partial
+	triangles, which are summed in a fixed order. Larger products run
+	syrk() one after another.
+
+	Parameters:
+	trans - whether A matrices are transposed
+	count - number of products
+	a - matrices A
+	c - result matrices
+*/
+void syrk_batch(bool trans, int count, const Matrix *a, Matrix *c)
+{
+	int groups = (count + SIMD_LANES - 1) / SIMD_LANES;
+	size_t tri;
+	Syrk_Lanes lanes;
+
+	if (count <= 0) {
+		return;
+	}
+	lanes.n = c[0].rows;
+	if ((count == 1) || (lanes.n > SYRK_BATCH_MAX)) {
+		for (int i = 0; i < count; ++i) {
+			syrk(trans, &a[i], &c[i]);
+		}
+		return;
+	}
+
+	lanes.a = a;
+	lanes.trans = trans;
+	lanes.count = count;
+	lanes.k = 0;
+	for (int i = 0; i < count; ++i) {
+		int k = trans ? a[i].rows : a[i].cols;
+		if (k > lanes.k) {
+			lanes.k = k;
+		}
+	}
+	lanes.chunks = (lanes.k + SYRK_KB - 1) / SYRK_KB;
+	if (lanes.chunks == 0) {
+		lanes.chunks = 1;
+	}
+	tri = (size_t)lanes.n * (lanes.n + 1) / 2 * SIMD_LANES;
+	lanes.partial = (double*)pool_scratch(SCRATCH_PARTIAL,
+		(size_t)groups * lanes.chunks * tri * sizeof(double));
+	memset(lanes.partial, 0,
+		(size_t)groups * lanes.chunks * tri * sizeof(double));
+
+	parallel_for(groups * lanes.chunks, _syrk_lanes, &lanes);
+	for (int s = 0; s < count; ++s) {
+		const double *part = lanes.partial +
+			(size_t)(s / SIMD_LANES) * lanes.chunks * tri + s % SIMD_LANES;
+		for (int i = 0; i < lanes.n; ++i) {
+			double *rowC = MATRIX_ROW(c[s], i);
+			for (int j = 0; j <= i; ++j) {
+				size_t e = (size_t)(i * (i + 1) / 2 + j) * SIMD_LANES;
+				rowC[j] = part[e];
+				for (int t = 1; t < lanes.chunks; ++t) {
+					rowC[j] += part[t * tri + e];
+				}
+			}
+		}
+	}
+}
+
+/*
+	Function: _syrk_chunk
+	----------------------
+	Internal function. Loop body of small syrk(), multiplies chunks of
+	the inner dimension from begin to end - 1 into their partial
+	triangles.
+
+	Parameters:
+	arg - operands of syrk()
+	begin - first chunk
+	end - one after last chunk
+*/
+void _syrk_chunk(void *arg, int begin, int end)
+{
+	Syrk_Parts *parts = (Syrk_Parts*)arg;
+	const Matrix *a = parts->a;
+	int n = parts->trans ? a->cols : a->rows;
+	int k = parts->trans ? a->rows : a->cols;
+
+	for (int t = begin; t < end; ++t) {
+		int p0 = t * SYRK_KB;
+		int kb = (k - p0 < SYRK_KB) ? k - p0 : SYRK_KB;
+		Matrix chunk = parts->trans ? matrix_view(a, p0, 0, kb, n) :
+			matrix_view(a, 0, p0, n, kb);
+		Matrix partial = matrix_wrap(parts->partial + (size_t)t * n * n,
+			n, n);
+
+		_gemm_blocked(parts->trans, !parts->trans, &chunk, &chunk, 0,
+			&partial, true);
+	}
+}
+
+/*
+	Function: _syrk_lanes
+	----------------------
+	Internal function. Loop body of syrk_batch(). Every task multiplies
+	one chunk of the inner dimension for one group of SIMD_LANES
+	matrices, interleaving SYRK_BATCH_KB columns of op(A) at a time.
+
+	Parameters:
+	arg - batch of syrk_batch()
+	begin - first task
+	end - one after last task
+*/
+void _syrk_lanes(void *arg, int begin, int end)
+{
+	Syrk_Lanes *lanes = (Syrk_Lanes*)arg;
+	size_t tri = (size_t)lanes->n * (lanes->n + 1) / 2 * SIMD_LANES;
+	double *pack = (double*)pool_scratch(SCRATCH_PACK_A,
+		(size_t)SYRK_BATCH_KB * lanes->n * SIMD_LANES * sizeof(double));
+
+	for (int t = begin; t < end; ++t) {
+		int group = t / lanes->chunks;
+		int p0 = t % lanes->chunks * SYRK_KB;
+		int p1 = (lanes->k - p0 < SYRK_KB) ? lanes->k : p0 + SYRK_KB;
+
+		for (int p = p0; p < p1; p += SYRK_BATCH_KB) {
+			int kb = (p1 - p < SYRK_BATCH_KB) ? p1 - p : SYRK_BATCH_KB;
+
+			_syrk_interleave(lanes, group, p, kb, pack);
+			simd.lanes_syrk(pack, lanes->n, kb,
+				lanes->partial + (size_t)t * tri);
+		}
+	}
+}
+
+/*
+	Function: _syrk_interleave
+	---------------------------
+	Internal function. Copies columns of op(A) of a group of matrices
+	into the layout of lanes_syrk, entry (i, p) of lane l is stored at
+	((p - p0) n + i) SIMD_LANES + l. Lanes past the batch and columns past
+	the inner dimension of a matrix are zero.
+
+	Parameters:
+	lanes - batch of syrk_batch()
+	group - group of SIMD_LANES matrices
+	p0 - first column of op(A)
+	kb - number of columns
+	pack - interleaved columns
+*/
+void _syrk_interleave(const Syrk_Lanes *lanes, int group, int p0, int kb,
+	double *pack)
+{
+	int n = lanes->n;
+
+	for (int l = 0; l < SIMD_LANES; ++l) {
+		int s = group * SIMD_LANES + l;
+		int valid = 0;
+
+		if (s < lanes->count) {
+			const Matrix *a = &lanes->a[s];
+			int k = lanes->trans ? a->rows : a->cols;
+
+			valid = (k - p0 < kb) ? k - p0 : kb;
+			if (valid < 0) {
+				valid = 0;
+			}
+			if (lanes->trans) {
+				for (int p = 0; p < valid; ++p) {
+					for (int i = 0; i < n; ++i) {
+						pack[(p * n + i) * SIMD_LANES + l] =
+							MATRIX_GET(*a, p0 + p, i);
+					}
+				}
+			}
+			else {
+				for (int i = 0; i < n; ++i) {
+					for (int p = 0; p < valid; ++p) {
+						pack[(p * n + i) * SIMD_LANES + l] =
+							MATRIX_GET(*a, i, p0 + p);
+					}
+				}
+			}
+		}
+		for (int p = valid; p < kb; ++p) {
+			for (int i = 0; i < n; ++i) {
+				pack[(p * n + i) * SIMD_LANES + l] = 0;
+			}
+		}
+	}
+}
+
+/*
+	Function: _gemm_parallel
+	-------------------------
+	Internal function. Runs a batch of multiplications of one shape on
+	the thread pool. Every C is split into tiles that are multiplied in
+	parallel. Every tile is a separate multiplication of a row block of
+	op(A) and a column block of op(B), so threads never write the same
+	entry. Small batches stay on the calling thread.
+
+	Parameters:
+	func - multiplication of one tile
+	transA - whether A is transposed
+	transB - whether B is transposed
+	count - number of products
+	a - matrices A
+	b - matrices B
+	beta - scaling of original C
+	c - result matrices
+*/
+void _gemm_parallel(Gemm_Func func, bool transA, bool transB, int count,
+	const Matrix *a, const Matrix *b, double beta, Matrix *c)
+{
+	int m = c->rows;
+	int n = c->cols;
+	int k = transA ? a->rows : a->cols;
+	int threads = pool_threads();
+	int rowTiles = 1;
+	int colTiles = 1;
+	Gemm_Tiles tiles;
+
+	if ((threads == 1) ||
+		((double)count * m * n * k < GEMM_PARALLEL_MIN)) {
+		for (int i = 0; i < count; ++i) {
+			func(transA, transB, &a[i], &b[i], beta, &c[i]);
+		}
+		return;
+	}
+
+	// Halves the longer side of tiles until every thread gets a few
+	while (count * rowTiles * colTiles < GEMM_TILES_PER_THREAD * threads) {
+		int rows = m / rowTiles;
+		int cols = n / colTiles;
+
+		if ((rows >= cols) && (rows >= 2 * GEMM_MR)) {
+			rowTiles *= 2;
+		}
+		else if (cols >= 2 * GEMM_NR) {
+			colTiles *= 2;
+		}
+		else if (rows >= 2 * GEMM_MR) {
+			rowTiles *= 2;
+		}
+		else {
+			break;
+		}
+	}
+
+	// Tiles cover whole register tiles
+	tiles.rows = (m + rowTiles - 1) / rowTiles;
+	tiles.rows = (tiles.rows + GEMM_MR - 1) / GEMM_MR * GEMM_MR;
+	tiles.cols = (n + colTiles - 1) / colTiles;
+	tiles.cols = (tiles.cols + GEMM_NR - 1) / GEMM_NR * GEMM_NR;
+	rowTiles = (m + tiles.rows - 1) / tiles.rows;
+	colTiles = (n + tiles.cols - 1) / tiles.cols;
+
+	tiles.func = func;
+	tiles.transA = transA;
+	tiles.transB = transB;
+	tiles.a = a;
+	tiles.b = b;
+	tiles.beta = beta;
+	tiles.c = c;
+	tiles.colTiles = colTiles;
+	tiles.tiles = rowTiles * colTiles;
+	parallel_for(count * tiles.tiles, _gemm_tile, &tiles);
+}
+
+/*
+	Function: _gemm_tile
+	---------------------
+	Internal function. Loop body of parallel multiplication, multiplies
+	tiles from begin to end - 1. Tiles of a batch are numbered product
+	after product.
+
+	Parameters:
+	arg - tiles of multiplication
+	begin - first tile
+	end - one after last tile
+*/
+void _gemm_tile(void *arg, int begin, int end)
+{
+	Gemm_Tiles *tiles = (Gemm_Tiles*)arg;
+
+	for (int t = begin; t < end; ++t) {
+		int product = t / tiles->tiles;
+		const Matrix *opA = &tiles->a[product];
+		const Matrix *opB = &tiles->b[product];
+		Matrix *opC = &tiles->c[product];
+		int r = t % tiles->tiles / tiles->colTiles * tiles->rows;
+		int c = t % tiles->colTiles * tiles->cols;
+		int rows = (opC->rows - r < tiles->rows) ? opC->rows - r : tiles->rows;
+		int cols = (opC->cols - c < tiles->cols) ? opC->cols - c : tiles->cols;
+		Matrix a = tiles->transA ?
+			matrix_view(opA, 0, r, opA->rows, rows) :
+			matrix_view(opA, r, 0, rows, opA->cols);
+		Matrix b = tiles->transB ?
+			matrix_view(opB, c, 0, cols, opB->cols) :
+			matrix_view(opB, 0, c, opB->rows, cols);
+		Matrix part = matrix_view(opC, r, c, rows, cols);
+
+		tiles->func(tiles->transA, tiles->transB, &a, &b, tiles->beta,
+			&part);
+	}
+}
+
+/*
+	Function: _gemm_serial
+	-----------------------
+	Internal function. Blocked multiplication on the calling thread.
+
+	Parameters:
+	transA - whether A is transposed
+	transB - whether B is transposed
+	a - matrix A
+	b - matrix B
+	beta - scaling of original C
+	c - result matrix
+*/
+void _gemm_serial(bool transA, bool transB, const Matrix *a,
+	const Matrix *b, double beta, Matrix *c)
+{
+	_gemm_blocked(transA, transB, a, b, beta, c, false);
+}
+
+/*
+	Function: _gemm_blocked
+	------------------------
+	Internal function. Blocked multiplication kernel. B is packed panel
+	by panel (KC x NC) and A block by block (MC x KC), so that the
+	micro-kernel only streams contiguous memory. The micro-kernel is
+	selected at startup, see simd.h. Operands of other storage types are
+	widened or dequantized to double while they are packed.
+
+	Parameters:
+	transA - whether A is transposed
+	transB - whether B is transposed
+	a - matrix A
+	b - matrix B
+	beta - scaling of original C
+	c - result matrix
+	lower - whether only register tiles reaching the lower triangle
+		of C are calculated
+*/
+void _gemm_blocked(bool transA, bool transB, const Matrix *a,
+	const Matrix *b, double beta, Matrix *c, bool lower)
+{
+	int m = c->rows;
+	int n = c->cols;
+	int k = transA ? a->rows : a->cols;
+	int mcMax = (m < GEMM_MC) ? m : GEMM_MC;
+	int ncMax = (n < GEMM_NC) ? n : GEMM_NC;
+	int kcMax = (k < GEMM_KC) ? k : GEMM_KC;
+	double *packA;
+	double *packB;
+
+	if ((m == 0) || (n == 0)) {
+		return;
+	}
+	if (k == 0) {
+		_gemm_scale(c, beta);
+		return;
+	}
+
+	// Packed buffers are padded to whole micro-panels
+	mcMax = (mcMax + GEMM_MR - 1) / GEMM_MR * GEMM_MR;
+	ncMax = (ncMax + GEMM_NR - 1) / GEMM_NR * GEMM_NR;
+	packA = (double*)pool_scratch(SCRATCH_PACK_A,
+		(size_t)mcMax * kcMax * sizeof(double));
+	packB = (double*)pool_scratch(SCRATCH_PACK_B,
+		(size_t)ncMax * kcMax * sizeof(double));
+
+	for (int jc = 0; jc < n; jc += GEMM_NC) {
+		int nc = (n - jc < GEMM_NC) ? n - jc : GEMM_NC;
+
+		for (int pc = 0; pc < k; pc += GEMM_KC) {
+			int kc = (k - pc < GEMM_KC) ? k - pc : GEMM_KC;
+			// Only the first panel scales original C
+			double scale = (pc == 0) ? beta : 1.0;
+
+			_gemm_pack_b(b, transB, pc, jc, kc, nc, packB);
+
+			for (int ic = 0; ic < m; ic += GEMM_MC) {
+				int mc = (m - ic < GEMM_MC) ? m - ic : GEMM_MC;
+
+				if (lower && (ic + mc <= jc)) {
+					// Block is above the diagonal
+					continue;
+				}
+				_gemm_pack_a(a, transA, ic, pc, mc, kc, packA);
+
+				for (int jr = 0; jr < nc; jr += GEMM_NR) {
+					int nr = (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR;
+
+					for (int ir = 0; ir < mc; ir += GEMM_MR) {
+						int mr = (mc - ir < GEMM_MR) ? mc - ir : GEMM_MR;
+
+						if (lower && (ic + ir + mr <= jc + jr)) {
+							continue;
+						}
+						simd.gemm_kernel(kc, &packA[(size_t)ir * kc],
+							&packB[(size_t)jr * kc],
+							&MATRIX_AT(*c, ic + ir, jc + jr), c->ld,
+							mr, nr, scale);
+					}
+				}
+			}
+		}
+	}
+}
+
+/*
+	Function: _gemm_rows_serial
+	----------------------------
+	Internal function. gemm_rows() on the calling thread. Float or
+	quantized blocks of B are converted to double before they are
+	combined, so sums are double like in every other path.
+
+	Parameters:
+	transA - whether A is transposed
+	transB - false, B is never transposed
+	a - matrix A
+	b - matrix B
+	beta - scaling of original C
+	c - result matrix
+*/
+void _gemm_rows_serial(bool transA, bool transB, const Matrix *a,
+	const Matrix *b, double beta, Matrix *c)
+{
+	int m = c->rows;
+	int n = c->cols;
+	int k = transA ? a->rows : a->cols;
+	int ncMax = (n < GEMM_ROWS_NB) ? n : GEMM_ROWS_NB;
+	double coef[GEMM_ROWS_KB];
+	const Group_Kernels *group;
+	double *wide = NULL;
+
+	// Rows of B are combined as they are stored, see _multiply_path()
+	assert(!transB);
+	(void)transB;
+	if ((m == 0) || (n == 0)) {
+		return;
+	}
+	if (k == 0) {
+		_gemm_scale(c, beta);
+		return;
+	}
+
+	if (b->type != MATRIX_F64) {
+		wide = (double*)pool_scratch(SCRATCH_WIDE_B,
+			(size_t)GEMM_ROWS_KB * ncMax * sizeof(double));
+	}
+
+	for (int jc = 0; jc < n; jc += GEMM_ROWS_NB) {
+		int nc = (n - jc < GEMM_ROWS_NB) ? n - jc : GEMM_ROWS_NB;
+
+		for (int pc = 0; pc < k; pc += GEMM_ROWS_KB) {
+			int kc = (k - pc < GEMM_ROWS_KB) ? k - pc : GEMM_ROWS_KB;
+			// Only the first block scales original C
+			double scale = (pc == 0) ? beta : 1.0;
+			const double *blockB;
+			size_t ldb = b->ld;
+
+			if (wide != NULL) {
+				for (int p = 0; p < kc; ++p) {
+					matrix_read(b, pc + p, jc, nc, wide + p * nc);
+				}
+				blockB = wide;
+				ldb = nc;
+			}
+			else {
+				blockB = &MATRIX_AT(*b, pc, jc);
+			}
+
+			// Rank-k updates by the group number have unrolled kernels
+			group = group_kernels(kc);
+			for (int i = 0; i < m; ++i) {
+				const double *rowA = coef;
+
+				if (transA || (a->type != MATRIX_F64)) {
+					for (int p = 0; p < kc; ++p) {
+						coef[p] = transA ? MATRIX_GET(*a, pc + p, i) :
+							MATRIX_GET(*a, i, pc + p);
+					}
+				}
+				else {
+					rowA = &MATRIX_AT(*a, i, pc);
+				}
+				if (group != NULL) {
+					group->combine(&MATRIX_AT(*c, i, jc), rowA, blockB, ldb,
+						nc, scale);
+				}
+				else {
+					simd.combine(&MATRIX_AT(*c, i, jc), rowA, blockB, ldb, kc,
+						nc, scale);
+				}
+			}
+		}
+	}
+}
+
+/*
+	Function: _gemm_dots_serial
+	----------------------------
+	Internal function. gemm_dots() on the calling thread. Float or
+	quantized operands are converted to double, so dot products are
+	double like in every other path.
+
+	Parameters:
+	transA - false, A is never transposed
+	transB - true, B is always transposed
+	a - matrix A
+	b - matrix B
+	beta - scaling of original C
+	c - result matrix
+*/
+void _gemm_dots_serial(bool transA, bool transB, const Matrix *a,
+	const Matrix *b, double beta, Matrix *c)
+{
+	int k = a->cols;
+	// All rows of B are read together when their number has a kernel
+	const Group_Kernels *group = group_kernels(c->cols);
+	double dots[GEMM_ROWS_KB];
+	const double *rowsB;
+	size_t ldb = b->ld;
+	double *wideA = NULL;
+
+	// Only this layout takes the dot path, see _multiply_path()
+	assert(!transA && transB);
+	(void)transA;
+	(void)transB;
+	// B is converted once, rows of A one at a time
+	if (b->type == MATRIX_F64) {
+		rowsB = MATRIX_ROW(*b, 0);
+	}
+	else {
+		double *wideB = (double*)pool_scratch(SCRATCH_WIDE_B,
+			(size_t)b->rows * k * sizeof(double));
+
+		for (int j = 0; j < b->rows; ++j) {
+			matrix_read(b, j, 0, k, wideB + (size_t)j * k);
+		}
+		rowsB = wideB;
+		ldb = k;
+	}
+	if (a->type != MATRIX_F64) {
+		wideA = (double*)pool_scratch(SCRATCH_WIDE_A,
+			(size_t)k * sizeof(double));
+	}
+
+	for (int i = 0; i < c->rows; ++i) {
+		double *rowC = MATRIX_ROW(*c, i);
+		const double *rowA = matrix_read(a, i, 0, k, wideA);
+
+		if (group != NULL) {
+			group->dots(rowA, rowsB, ldb, dots, k);
+		}
+		for (int j = 0; j < c->cols; ++j) {
+			double value = (group != NULL) ? dots[j] :
+				simd.dot(rowA, rowsB + j * ldb, k);
+			rowC[j] = (beta == 0) ? value : value + beta * rowC[j];
+		}
+	}
+}
+
+/*
+	Function: _gemm_pack_a
+	-----------------------
+	Internal function. Packs a block of op(A) into micro-panels of
+	GEMM_MR rows. Each panel stores its columns one after another, and
+	short panels at the bottom edge are padded with 0s. Entries are
+	widened or dequantized to double, see _gemm_gather().
+
+	Parameters:
+	a - matrix A
+	trans - whether A is transposed
+	r - first row of the block in op(A)
+	c - first column of the block in op(A)
+	mc - row number of the block
+	kc - column number of the block
+	pack - packed buffer
+*/
+void _gemm_pack_a(const Matrix *a, bool trans, int r, int c, int mc,
+	int kc, double *pack)
+{
+	// Distances between rows and columns of op(A)
+	size_t rs = trans ? 1 : a->ld;
+	size_t cs = trans ? a->ld : 1;
+	size_t first = trans ? a->offset + (size_t)c * a->ld + r :
+		a->offset + (size_t)r * a->ld + c;
+
+	for (int ir = 0; ir < mc; ir += GEMM_MR) {
+		int mr = (mc - ir < GEMM_MR) ? mc - ir : GEMM_MR;
+		size_t panel = first + ir * rs;
+
+		for (int p = 0; p < kc; ++p) {
+			_gemm_gather(a, panel + p * cs, rs, mr, pack);
+			for (int i = mr; i < GEMM_MR; ++i) {
+				pack[i] = 0;
+			}
+			pack += GEMM_MR;
+		}
+	}
+}
+
+/*
+	Function: _gemm_pack_b
+	-----------------------
+	Internal function. Packs a panel of op(B) into micro-panels of
+	GEMM_NR columns. Each micro-panel stores its rows one after another,
+	and short micro-panels at the right edge are padded with 0s. Entries
+	are widened or dequantized to double, see _gemm_gather().
+
+	Parameters:
+	b - matrix B
+	trans - whether B is transposed
+	r - first row of the panel in op(B)
+	c - first column of the panel in op(B)
+	kc - row number of the panel
+	nc - column number of the panel
+	pack - packed buffer
+*/
+void _gemm_pack_b(const Matrix *b, bool trans, int r, int c, int kc,
+	int nc, double *pack)
+{
+	// Distances between rows and columns of op(B)
+	size_t rs = trans ? 1 : b->ld;
+	size_t cs = trans ? b->ld : 1;
+	size_t first = trans ? b->offset + (size_t)c * b->ld + r :
+		b->offset + (size_t)r * b->ld + c;
+
+	for (int jr = 0; jr < nc; jr += GEMM_NR) {
+		int nr = (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR;
+		size_t panel = first + jr * cs;
+
+		for (int p = 0; p < kc; ++p) {
+			_gemm_gather(b, panel + p * rs, cs, nr, pack);
+			for (int j = nr; j < GEMM_NR; ++j) {
+				pack[j] = 0;
+			}
+			pack += GEMM_NR;
+		}
+	}
+}
+
+/*
+	Function: _gemm_gather
+	-----------------------
+	Internal function. Copies entries at a fixed distance in the buffer
+	of a matrix as doubles, for the packing routines. Quantized entries
+	are decoded here, so the micro-kernel never sees codes.
+
+	Parameters:
+	a - matrix
+	pos - buffer position of the first entry
+	stride - buffer distance between two entries
+	n - number of entries
+	r - copied entries
+*/
+void _gemm_gather(const Matrix *a, size_t pos, size_t stride, int n,
+	double *r)
+{
+	switch (a->type) {
+	case MATRIX_F64:
+		for (int i = 0; i < n; ++i) {
+			r[i] = a->data[pos + i * stride];
+		}
+		break;
+	case MATRIX_F32:
+		for (int i = 0; i < n; ++i) {
+			r[i] = a->data32[pos + i * stride];
+		}
+		break;
+	case MATRIX_U8:
+		for (int i = 0; i < n; ++i) {
+			unsigned char code = a->data8[pos + i * stride];
+			r[i] = (code == 0) ? a->fill : a->bias + a->scale * code;
+		}
+		break;
+	default:
+		for (int i = 0; i < n; ++i) {
+			unsigned short code = a->data16[pos + i * stride];
+			r[i] = (code == 0) ? a->fill : a->bias + a->scale * code;
+		}
+		break;
+	}
+}
+
+/*
+	Function: _gemm_scale
+	----------------------
+	Internal function. Scales C by beta when there is nothing to
+	multiply.
+
+	Parameters:
+	c - result matrix
+	beta - scaling factor
+*/
+void _gemm_scale(Matrix *c, double beta)
+{
+	for (int i = 0; i < c->rows; ++i) {
+		double *rowC = MATRIX_ROW(*c, i);
+		for (int j = 0; j < c->cols; ++j) {
+			rowC[j] = (beta == 0) ? 0 : beta * rowC[j];
+		}
+	}
+}
@@ -0,0 +1,245 @@
+#include "kernels.h"
+#include "simd.h"
+#include "simd_target.h"
+#include <math.h>
+
+/*
+ * Kernels are generated from kernel_body.h for every instruction set
+ * and every group number below.
+ */
+#define GROUP_SIZES 5	// Specialized group numbers: 2, 4, 8, 16, 32
+
+#define GK_PASTE2(isa, f, c) isa##_##f##_##c
+#define GK_PASTE(isa, f, c) GK_PASTE2(isa, f, c)
+#define GK_NAME(f) GK_PASTE(GK_ISA, f, GK_C)
+
+// Generates kernels of one instruction set into a row of group_table
+#define GK_ROW(isa) { \
+	{ 2, isa##_combine_2, isa##_dots_2, isa##_update_w_2, \
+		isa##_sqdiff_rows_2 }, \
+	{ 4, isa##_combine_4, isa##_dots_4, isa##_update_w_4, \
+		isa##_sqdiff_rows_4 }, \
+	{ 8, isa##_combine_8, isa##_dots_8, isa##_update_w_8, \
+		isa##_sqdiff_rows_8 }, \
+	{ 16, isa##_combine_16, isa##_dots_16, isa##_update_w_16, \
+		isa##_sqdiff_rows_16 }, \
+	{ 32, isa##_combine_32, isa##_dots_32, isa##_update_w_32, \
+		isa##_sqdiff_rows_32 } }
+
+/*	Scalar kernels	*/
+
+#define GK_ISA _scalar
+#define GK_ATTR
+#define VEC double
+#define VEC_W 1
+#define V_ZERO() 0.0
+#define V_SET1(x) (x)
+#define V_LOAD(p) (*(p))
+#define V_STORE(p, x) (*(p) = (x))
+#define V_ADD(a, b) ((a) + (b))
+#define V_SUB(a, b) ((a) - (b))
+#define V_MUL(a, b) ((a) * (b))
+#define V_DIV(a, b) ((a) / (b))
+#define V_FMA(a, b, c) ((a) * (b) + (c))
+#define V_SQRT(x) sqrt(x)
+#define V_SUM(x) (x)
+#define V_POS(x) (((x) > 0) ? (x) : 0.0)
+#define V_NEG(x) (((x) > 0) ? 0.0 : (x))
+
+#define GK_C 2
+#include "kernel_body.h"
+#undef GK_C
+#define GK_C 4
+#include "kernel_body.h"
+#undef GK_C
+#define GK_C 8
+#include "kernel_body.h"
+#undef GK_C
+#define GK_C 16
+#include "kernel_body.h"
+#undef GK_C
+#define GK_C 32
+#include "kernel_body.h"
+#undef GK_C
+
+#undef GK_ISA
+#undef GK_ATTR
+#undef VEC
+#undef VEC_W
+#undef V_ZERO
+#undef V_SET1
+#undef V_LOAD
+#undef V_STORE
+#undef V_ADD
+#undef V_SUB
+#undef V_MUL
+#undef V_DIV
+#undef V_FMA
+#undef V_SQRT
+#undef V_SUM
+#undef V_POS
+#undef V_NEG
+
+#ifdef SIMD_X86
+
+/*	AVX2 kernels	*/
+
+SIMD_AVX2 double _avx2_sum(__m256d x)
+{
+	double part[4];
+
+	_mm256_storeu_pd(part, x);
+	return (part[0] + part[1]) + (part[2] + part[3]);
+}
+
+#define GK_ISA _avx2
+#define GK_ATTR SIMD_AVX2
+#define VEC __m256d
+#define VEC_W 4
+#define V_ZERO() _mm256_setzero_pd()
+#define V_SET1(x) _mm256_set1_pd(x)
+#define V_LOAD(p) _mm256_loadu_pd(p)
+#define V_STORE(p, x) _mm256_storeu_pd(p, x)
+#define V_ADD(a, b) _mm256_add_pd(a, b)
+#define V_SUB(a, b) _mm256_sub_pd(a, b)
+#define V_MUL(a, b) _mm256_mul_pd(a, b)
+#define V_DIV(a, b) _mm256_div_pd(a, b)
+#define V_FMA(a, b, c) _mm256_fmadd_pd(a, b, c)
+#define V_SQRT(x) _mm256_sqrt_pd(x)
+#define V_SUM(x) _avx2_sum(x)
+#define V_POS(x) _mm256_and_pd(_mm256_cmp_pd(x, V_ZERO(), _CMP_GT_OQ), x)
+#define V_NEG(x) _mm256_andnot_pd(_mm256_cmp_pd(x, V_ZERO(), _CMP_GT_OQ), x)
+
+#define GK_C 2
+#include "kernel_body.h"
+#undef GK_C
+#define GK_C 4
+#include "kernel_body.h"
+#undef GK_C
+#define GK_C 8
+#include "kernel_body.h"
+#undef GK_C
+#define GK_C 16
+#include "kernel_body.h"
+#undef GK_C
+#define GK_C 32
+#include "kernel_body.h"
+#undef GK_C
+
+#undef GK_ISA
+#undef GK_ATTR
+#undef VEC
+#undef VEC_W
+#undef V_ZERO
+#undef V_SET1
+#undef V_LOAD
+#undef V_STORE
+#undef V_ADD
+#undef V_SUB
+#undef V_MUL
+#undef V_DIV
+#undef V_FMA
+#undef V_SQRT
+#undef V_SUM
+#undef V_POS
+#undef V_NEG
+
+#ifdef SIMD_HAS_AVX512
+
+/*	AVX-512 kernels	*/
+
+#define GK_ISA _avx512
+#define GK_ATTR SIMD_AVX512
+#define VEC __m512d
+#define VEC_W 8
+#define V_ZERO() _mm512_setzero_pd()
+#define V_SET1(x) _mm512_set1_pd(x)
+#define V_LOAD(p) _mm512_loadu_pd(p)
+#define V_STORE(p, x) _mm512_storeu_pd(p, x)
+#define V_ADD(a, b) _mm512_add_pd(a, b)
+#define V_SUB(a, b) _mm512_sub_pd(a, b)
+#define V_MUL(a, b) _mm512_mul_pd(a, b)
+#define V_DIV(a, b) _mm512_div_pd(a, b)
+#define V_FMA(a, b, c) _mm512_fmadd_pd(a, b, c)
+#define V_SQRT(x) _mm512_sqrt_pd(x)
+#define V_SUM(x) _mm512_reduce_add_pd(x)
+#define V_POS(x) _mm512_maskz_mov_pd( \
+	_mm512_cmp_pd_mask(x, V_ZERO(), _CMP_GT_OQ), x)
+#define V_NEG(x) _mm512_maskz_mov_pd( \
+	(__mmask8)~_mm512_cmp_pd_mask(x, V_ZERO(), _CMP_GT_OQ), x)
+
+#define GK_C 2
+#include "kernel_body.h"
+#undef GK_C
+#define GK_C 4
+#include "kernel_body.h"
+#undef GK_C
+#define GK_C 8
+#include "kernel_body.h"
+#undef GK_C
+#define GK_C 16
+#include "kernel_body.h"
+#undef GK_C
+#define GK_C 32
+#include "kernel_body.h"
+#undef GK_C
+
+#undef GK_ISA
+#undef GK_ATTR
+#undef VEC
+#undef VEC_W
+#undef V_ZERO
+#undef V_SET1
+#undef V_LOAD
+#undef V_STORE
+#undef V_ADD
+#undef V_SUB
+#undef V_MUL
+#undef V_DIV
+#undef V_FMA
+#undef V_SQRT
+#undef V_SUM
+#undef V_POS
+#undef V_NEG
+
+#endif
+#endif
+
+// Kernels by instruction set and group number. Instruction sets that
+// cannot be compiled reuse scalar kernels, they are never selected.
+Group_Kernels group_table[ISA_COUNT][GROUP_SIZES] = {
+	GK_ROW(_scalar),
+#ifdef SIMD_X86
+	GK_ROW(_avx2),
+#else
+	GK_ROW(_scalar),
+#endif
+#ifdef SIMD_HAS_AVX512
+	GK_ROW(_avx512)
+#else
+	GK_ROW(_scalar)
+#endif
+};
+
+/*
+	Function: group_kernels
+	------------------------
+	Finds kernels specialized for a group number, for the instruction
+	set selected by simd_initialize().
+
+	Parameters:
+	c - group number
+
+	Returns:
+	specialized kernels, or NULL when c has none
+*/
+const Group_Kernels *group_kernels(int c)
+{
+	for (int i = 0; i < GROUP_SIZES; ++i) {
+		if (group_table[simd.isa][i].groups == c) {
+			return &group_table[simd.isa][i];
+		}
+	}
+
+	return NULL;
+}
@@ -6,6 +6,8 @@
 #include "algorithms.h"
 #include "utility.h"
 #include "matrix.h"
+#include "simd.h"
+#include "threadpool.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -22,8 +24,14 @@ int main()
 	int srcSz;	// Number of source files
 	int srcIndex = 0;	// Index of source that is being operated
 	bool isReadData;	// Tells if it should read data from the source now
+	Matrix_Type storage;	// Storage type of ratings
+	bool sparse;	// Whether ratings are stored sparse
 
 	printf("\n%s\n", menu);
+	// Picks vectorized kernels for this processor
+	simd_initialize();
+	// Starts one thread per processor for multiplications
+	pool_initialize(0);
 
 	while (true) {
 Starting:
@@ -35,6 +43,22 @@ Starting:
 		if (srcSz > 0) {
 			source = (Source*)malloc(srcSz * sizeof(*source));
 
+			// Enter storage of ratings
+			printf("%s: ", cmd6);
+			gets_s(cmd, sizeof(cmd));
+
+			// Reset commande detector
+			if (!(strcmp(cmd, "R") && strcmp(cmd, "r"))) {
+				reset(source, 0);
+				printf("[RESET]\n\n");
+				goto Starting;
+			}
+			// Quit command detector
+			if (!(strcmp(cmd, "Q") && strcmp(cmd, "q"))) {
+				goto Ending;
+			}
+			storage = read_storage(cmd, &sparse);
+
 			while (srcIndex < srcSz) {
 				// Enter path
 				printf("%s(%d left):\n> ", cmd2, srcSz - srcIndex);
@@ -94,7 +118,7 @@ Starting:
 					get_dimension(input, &source[srcIndex]);
 				}
 
-				inputs_initialize(&source[srcIndex]);
+				inputs_initialize(&source[srcIndex], storage, sparse);
 
 				// Read dataset
 				if (file_to_matrix(input, &source[srcIndex])) {
@@ -112,8 +136,10 @@ Starting:
 			while (true) {
 				int val_c;
 				double alpha;
+				Options options;
 				double **res;
 				FILE *f;
+				Arena work;	// Workspace of the solver
 
 				// Enter number of groups
 				printf("%s: ", cmd3);
@@ -147,10 +173,33 @@ Starting:
 					}
 
 					if ((alpha = find_number(cmd)) > 0) {
+						printf("%s: ", cmd5);
+						gets_s(cmd, sizeof(cmd));
+
+						// Reset command detector
+						if (!(strcmp(cmd, "R") && strcmp(cmd, "r"))) {
+							reset(source, srcSz);
+							printf("[RESET]\n\n");
+							goto Starting;
+						}
+						// Quit command detector
+						if (!(strcmp(cmd, "Q") && strcmp(cmd, "q"))) {
+							goto Ending;
+						}
+
+						read_options(cmd, &options);
+						pool_initialize(options.threads);
+						strassen_cutoff = options.strassen;
+						precision = options.precision;
+						cost_norm = options.cost;
+						objective = options.objective;
+						solver_mode = options.solver;
+						solver_staleness = options.staleness;
+
 						// Initialize joint matrices
-						joints_initialize(source, srcSz, val_c);
+						joints_initialize(source, srcSz, val_c, &work);
 						// Perform algorithms
-						matrix_factorization(source, srcSz, alpha);
+						matrix_factorization(source, srcSz, alpha, &work);
 
 						// Calculates and ecords reliable matrix
 						res = get_reliable(source, srcSz);
@@ -166,7 +215,7 @@ Starting:
 
 						fclose(f);
 						clear2D(&res, srcSz);
-						joint_clear(source, srcSz);
+						joint_clear(source, srcSz, &work);
 					}
 				}
 				else {
@@ -187,6 +236,7 @@ Starting:
 	}
 	
 Ending:
+	pool_shutdown();
 	printf("%s\n", end);
 	return 0;
 }
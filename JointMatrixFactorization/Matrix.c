@@ -1,302 +1,1039 @@
 #include "matrix.h"
+#include "gemm.h"
+#include "simd.h"
+#include "kernels.h"
 #include "utility.h"
+#include "threadpool.h"
+#include "allocator.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <malloc.h>
 #include <math.h>
+#include <limits.h>
+#include <string.h>
+#ifdef _WIN32
+#include <intrin.h>
+#endif
+
+size_t strassen_space(int, int, int);
+void strassen_multiply(bool, bool, const Matrix*, const Matrix*, Matrix*,
+	double*);
+Matrix _multiply(bool, bool, const Matrix*, const Matrix*);
+Multiply_Path _multiply_path(bool, bool, int, int, int);
+Matrix _gram(bool, const Matrix*);
+void _transpose_strip(void*, int, int);
+void _transpose_block(const double*, size_t, double*, size_t, int, int,
+	bool);
+Matrix _op_view(const Matrix*, bool, int, int, int, int);
+double *_read_buffer(const Matrix*, int, Scratch_Slot);
+double _code_max(Matrix_Type);
+void _gram_apply(const Matrix*, const double*, double*, double*);
+double _lanczos_ritz(const double*, const double*, int, double*);
+void _count_path(Multiply_Path, long);
+
+// Smallest dimension that still recurses in Strassen multiplication
+int strassen_cutoff = STRASSEN_DIM;
+Precision precision = PRECISION_DOUBLE;
+long multiply_paths[PATH_COUNT] = { 0 };
+Multiply_Path multiply_last_path = PATH_BLOCKED;
+const char *path_names[PATH_COUNT] = {
+	"rank-k", "panel", "blocked", "strassen", "syrk"
+};
+
+typedef struct Transpose_Job
+{
+	const Matrix *a;
+	Matrix *r;
+	bool stream;	// Whether R is written around the caches
+} Transpose_Job;
+
+/*
+	Function: matrix_new
+	---------------------
+	Allocates a zero filled matrix in one contiguous buffer.
+
+	Parameters:
+	r - row number
+	c - column number
+
+	Returns:
+	new matrix which owns its buffer
+*/
+Matrix matrix_new(int r, int c)
+{
+	return matrix_typed(r, c, MATRIX_F64);
+}
+
+/*
+	Function: matrix_typed
+	-----------------------
+	Allocates a zero filled matrix of a storage type in one contiguous
+	buffer, see buffer_alloc(). Quantized matrices start with scale 1,
+	bias 0 and fill 0, see matrix_set_range().
+
+	Parameters:
+	r - row number
+	c - column number
+	type - storage type of entries
+
+	Returns:
+	new matrix which owns its buffer
+*/
+Matrix matrix_typed(int r, int c, Matrix_Type type)
+{
+	Matrix result;
+	size_t count = (size_t)r * c;
+	void *buffer = NULL;
+
+	count = (count > 0) ? count : 1;
+	result.rows = r;
+	result.cols = c;
+	result.ld = c;
+	result.offset = 0;
+	result.owner = true;
+	result.type = type;
+	result.data = NULL;
+	result.data32 = NULL;
+	result.data8 = NULL;
+	result.data16 = NULL;
+	result.scale = 1;
+	result.bias = 0;
+	result.fill = 0;
+	switch (type) {
+	case MATRIX_F64:
+		buffer = result.data = (double*)buffer_alloc(count *
+			sizeof(double), true);
+		break;
+	case MATRIX_F32:
+		buffer = result.data32 = (float*)buffer_alloc(count *
+			sizeof(float), true);
+		break;
+	case MATRIX_U8:
+		buffer = result.data8 = (unsigned char*)buffer_alloc(count *
+			sizeof(unsigned char), true);
+		break;
+	default:
+		buffer = result.data16 = (unsigned short*)buffer_alloc(count *
+			sizeof(unsigned short), true);
+		break;
+	}
+	if (buffer == NULL) {
+		fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
+		getchar();
+		exit(1);
+	}
+
+	return result;
+}
+
+/*
+	Function: matrix_view
+	----------------------
+	Describes a sub matrix of another matrix. No entry is copied, so
+	writing to the view writes to its parent.
+
+	Parameters:
+	a - parent matrix
+	r - row index of the first view entry in parent
+	c - column index of the first view entry in parent
+	rows - row number of the view
+	cols - column number of the view
+
+	Returns:
+	view matrix which does not own its buffer
+*/
+Matrix matrix_view(const Matrix *a, int r, int c, int rows, int cols)
+{
+	Matrix view = *a;
+
+	view.rows = rows;
+	view.cols = cols;
+	view.offset = a->offset + (size_t)r * a->ld + c;
+	view.owner = false;
+
+	return view;
+}
+
+/*
+	Function: matrix_wrap
+	----------------------
+	Describes an existing buffer as a compact matrix. The buffer is not
+	copied and is not owned by the result.
+
+	Parameters:
+	buffer - entries buffer, at least r * c long
+	r - row number
+	c - column number
+
+	Returns:
+	matrix which does not own its buffer
+*/
+Matrix matrix_wrap(double *buffer, int r, int c)
+{
+	Matrix result;
+
+	result.rows = r;
+	result.cols = c;
+	result.ld = c;
+	result.offset = 0;
+	result.owner = false;
+	result.type = MATRIX_F64;
+	result.data = buffer;
+	result.data32 = NULL;
+	result.data8 = NULL;
+	result.data16 = NULL;
+	result.scale = 1;
+	result.bias = 0;
+	result.fill = 0;
+
+	return result;
+}
+
+/*
+	Function: matrix_free
+	----------------------
+	Releases buffer of a matrix if it is the owner. Views are only
+	detached.
+
+	Parameters:
+	a - matrix to be cleared
+*/
+void matrix_free(Matrix *a)
+{
+	if (a->owner) {
+		buffer_free(a->data);
+		buffer_free(a->data32);
+		buffer_free(a->data8);
+		buffer_free(a->data16);
+	}
+	a->data = NULL;
+	a->data32 = NULL;
+	a->data8 = NULL;
+	a->data16 = NULL;
+	a->owner = false;
+	a->rows = 0;
+	a->cols = 0;
+}
+
+/*
+	Function: arena_new
+	--------------------
+	Allocates an arena, one buffer that hands out matrices in order.
+	Matrices of a solver run are taken from an arena sized before the
+	run, so that its iterations do not allocate.
+
+	Parameters:
+	size - capacity in doubles
+
+	Returns:
+	new empty arena
+*/
+Arena arena_new(size_t size)
+{
+	Arena arena;
+
+	arena.size = size;
+	arena.used = 0;
+	arena.buffer = (double*)buffer_alloc(((size > 0) ? size : 1) *
+		sizeof(double), false);
+	if (arena.buffer == NULL) {
+		fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
+		getchar();
+		exit(1);
+	}
+
+	return arena;
+}
+
+/*
+	Function: arena_matrix
+	-----------------------
+	Takes a compact double matrix from the unused part of an arena.
+	Entries are not initialized.
+
+	Parameters:
+	arena - arena
+	r - row number
+	c - column number
+
+	Returns:
+	matrix which does not own its buffer
+*/
+Matrix arena_matrix(Arena *arena, int r, int c)
+{
+	return matrix_wrap(arena_take(arena, (size_t)r * c), r, c);
+}
+
+/*
+	Function: arena_take
+	---------------------
+	Takes a buffer from the unused part of an arena, for entries that
+	are not matrices. Entries are not initialized.
+
+	Parameters:
+	arena - arena
+	count - number of doubles
+
+	Returns:
+	buffer of count doubles
+*/
+double *arena_take(Arena *arena, size_t count)
+{
+	double *result;
+
+	if (arena->size - arena->used < count) {
+		fprintf(stderr, "Fatal Error: Workspace is too small!\n");
+		getchar();
+		exit(1);
+	}
+	result = arena->buffer + arena->used;
+	arena->used += count;
+
+	return result;
+}
+
+/*
+	Function: arena_reset
+	----------------------
+	Gives back all matrices of an arena, which must not be used anymore.
+
+	Parameters:
+	arena - arena
+*/
+void arena_reset(Arena *arena)
+{
+	arena->used = 0;
+}
+
+/*
+	Function: arena_free
+	---------------------
+	Releases the buffer of an arena.
+
+	Parameters:
+	arena - arena
+*/
+void arena_free(Arena *arena)
+{
+	buffer_free(arena->buffer);
+	arena->buffer = NULL;
+	arena->size = 0;
+	arena->used = 0;
+}
+
+/*
+	Function: matrix_convert
+	-------------------------
+	Changes the storage type of a matrix. Entries are copied into a new
+	compact buffer owned by the matrix, and the old buffer is released
+	if it was owned. Quantized results cover the range of the entries,
+	with the smallest entry as their fill.
+
+	Parameters:
+	a - matrix to be converted
+	type - new storage type
+*/
+void matrix_convert(Matrix *a, Matrix_Type type)
+{
+	Matrix result;
+	double *buffer;
+
+	if (a->type == type) {
+		return;
+	}
+
+	result = matrix_typed(a->rows, a->cols, type);
+	buffer = _read_buffer(a, a->cols, SCRATCH_READ_A);
+	if ((type == MATRIX_U8) || (type == MATRIX_U16)) {
+		double lo = 0;
+		double hi = 0;
+		bool integer = true;
+
+		for (int i = 0; i < a->rows; ++i) {
+			const double *row = matrix_read(a, i, 0, a->cols, buffer);
+			for (int j = 0; j < a->cols; ++j) {
+				if (((i == 0) && (j == 0)) || (row[j] < lo)) {
+					lo = row[j];
+				}
+				if (((i == 0) && (j == 0)) || (row[j] > hi)) {
+					hi = row[j];
+				}
+				integer = integer && (row[j] == floor(row[j]));
+			}
+		}
+		matrix_set_range(&result, lo, lo, hi, integer);
+	}
+
+	for (int i = 0; i < a->rows; ++i) {
+		const double *row = matrix_read(a, i, 0, a->cols, buffer);
+
+		switch (type) {
+		case MATRIX_F64:
+			memcpy(MATRIX_ROW(result, i), row, a->cols * sizeof(double));
+			break;
+		case MATRIX_F32:
+			simd.narrow(row, MATRIX_ROW32(result, i), a->cols);
+			break;
+		default:
+			for (int j = 0; j < a->cols; ++j) {
+				matrix_encode(&result, i, j, row[j]);
+			}
+			break;
+		}
+	}
+
+	matrix_free(a);
+	*a = result;
+}
+
+/*
+	Function: matrix_read
+	----------------------
+	Reads consecutive entries of a row as doubles. Entries of double
+	matrices are not copied, others are widened or dequantized.
+
+	Parameters:
+	a - matrix A
+	i - row index
+	j - column index of the first entry
+	n - number of entries
+	buffer - space of n doubles, used when A is not double
+
+	Returns:
+	pointer to the entries, either into A or buffer
+*/
+const double *matrix_read(const Matrix *a, int i, int j, int n,
+	double *buffer)
+{
+	switch (a->type) {
+	case MATRIX_F64:
+		return &MATRIX_AT(*a, i, j);
+	case MATRIX_F32:
+		simd.widen(&MATRIX_AT32(*a, i, j), buffer, n);
+		break;
+	case MATRIX_U8:
+		simd.decode_u8(a->data8 + MATRIX_POS(*a, i, j), a->scale, a->bias,
+			a->fill, buffer, n);
+		break;
+	default:
+		simd.decode_u16(a->data16 + MATRIX_POS(*a, i, j), a->scale, a->bias,
+			a->fill, buffer, n);
+		break;
+	}
+
+	return buffer;
+}
+
+/*
+	Function: matrix_set_range
+	---------------------------
+	Sets the range of a quantized matrix. Code 0 is reserved for fill,
+	the other codes cover lo to hi. Integer entries get one code each,
+	code 1 for lo, so they are stored exactly as long as there are
+	enough codes. Otherwise codes are evenly spaced, code 1 for lo and
+	the largest code for hi. Stored codes are not changed, so it is
+	called before entries are written.
+
+	Parameters:
+	a - quantized matrix
+	fill - entry of code 0, usually the one of unrated entries
+	lo - smallest entry other than fill
+	hi - largest entry
+	integer - whether all entries other than fill are integers
+*/
+void matrix_set_range(Matrix *a, double fill, double lo, double hi,
+	bool integer)
+{
+	double top = _code_max(a->type);
+
+	a->fill = fill;
+	if ((hi > lo) && (!integer || (hi - lo >= top))) {
+		a->scale = (hi - lo) / (top - 1);
+	}
+	else {
+		a->scale = 1;
+	}
+	a->bias = lo - a->scale;
+}
+
+/*
+	Function: matrix_encode
+	------------------------
+	Stores an entry of a quantized matrix as its nearest code. Only the
+	fill is stored as code 0, other entries outside the range of the
+	matrix are clamped.
+
+	Parameters:
+	a - quantized matrix
+	i - row index
+	j - column index
+	x - entry
+*/
+void matrix_encode(Matrix *a, int i, int j, double x)
+{
+	double top = _code_max(a->type);
+	double code = 0;
+
+	if (x != a->fill) {
+		code = floor((x - a->bias) / a->scale + 0.5);
+		code = (code < 1) ? 1 : ((code > top) ? top : code);
+	}
+	if (a->type == MATRIX_U8) {
+		a->data8[MATRIX_POS(*a, i, j)] = (unsigned char)code;
+	}
+	else {
+		a->data16[MATRIX_POS(*a, i, j)] = (unsigned short)code;
+	}
+}
 
-void strassen_multiply(double**, int, int, int, int, double**, int,
-	int, int, int, double**);
-double eigenL(double**, int);
-double euclidean_dist(double*, double*, int);
-double** matrix_sum(double**, int, int, int, int, int, int, int, int);
-double** matrix_sub(double**, int, int, int, int, int, int, int, int);
-void matrix_pad(double***, int*, int*);
+/*
+	Function: _code_max
+	--------------------
+	Internal function. Finds the largest code of a quantized type.
+
+	Parameters:
+	type - quantized storage type
+
+	Returns:
+	largest code
+*/
+double _code_max(Matrix_Type type)
+{
+	return (type == MATRIX_U8) ? UCHAR_MAX : USHRT_MAX;
+}
+
+/*
+	Function: _read_buffer
+	-----------------------
+	Internal function. Provides space for matrix_read() when a matrix is
+	not double. The space is a work buffer of the calling thread, see
+	pool_scratch(), and is not freed.
+
+	Parameters:
+	a - matrix A
+	n - number of entries read at once
+	slot - work buffer used
+
+	Returns:
+	buffer of n doubles, or NULL when A is double
+*/
+double *_read_buffer(const Matrix *a, int n, Scratch_Slot slot)
+{
+	if (a->type == MATRIX_F64) {
+		return NULL;
+	}
+
+	return (double*)pool_scratch(slot, (size_t)n * sizeof(double));
+}
 
 /*
 	Function: multiply
 	--------------------------
-	Matrix multiplication method. It uses standard multiplication method
-	when matrix	size is small, uses Strassen multiplication for large 
-	matrix computing.
+	Matrix multiplication method. The kernel is chosen by the shape of
+	the product, see _multiply_path().
 
 	Parameter:
 	a - matrix A
-	rA - row number of matrix A
 	b - matrix B
-	cB - column number of matrix B
-	mid - column number of A/row number of B
 
 	Returns:
 	result matrix
 */
-double** multiply(double **a, int rA, double **b, int cB, int mid)
+Matrix multiply(const Matrix *a, const Matrix *b)
 {
-	double **result = (double**)malloc(rA * sizeof(double*));
-	if (result == NULL) {
-		fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
-		getchar();
-		exit(1);
+	return _multiply(false, false, a, b);
+}
+
+/*
+	Function: multiply_tn
+	----------------------
+	Calculates transpose(A) B without building transpose(A).
+
+	Parameter:
+	a - matrix A
+	b - matrix B
+
+	Returns:
+	result matrix
+*/
+Matrix multiply_tn(const Matrix *a, const Matrix *b)
+{
+	return _multiply(true, false, a, b);
+}
+
+/*
+	Function: multiply_nt
+	----------------------
+	Calculates A transpose(B) without building transpose(B).
+
+	Parameter:
+	a - matrix A
+	b - matrix B
+
+	Returns:
+	result matrix
+*/
+Matrix multiply_nt(const Matrix *a, const Matrix *b)
+{
+	return _multiply(false, true, a, b);
+}
+
+/*
+	Function: gram_tn
+	------------------
+	Calculates the Gram matrix transpose(A) A of the columns of A.
+
+	Parameter:
+	a - matrix A
+
+	Returns:
+	symmetric result matrix
+*/
+Matrix gram_tn(const Matrix *a)
+{
+	return _gram(true, a);
+}
+
+/*
+	Function: gram_nt
+	------------------
+	Calculates the Gram matrix A transpose(A) of the rows of A.
+
+	Parameter:
+	a - matrix A
+
+	Returns:
+	symmetric result matrix
+*/
+Matrix gram_nt(const Matrix *a)
+{
+	return _gram(false, a);
+}
+
+/*
+	Function: multiply_batch
+	-------------------------
+	Calculates op(A[i])op(B[i]) for a batch of products of one shape,
+	where op() transposes operands when the flags are set. The kernel is
+	chosen once for the shape, see _multiply_path(), and all products
+	run in one parallel loop, see gemm_batch().
+
+	Parameter:
+	transA - whether A matrices are transposed
+	transB - whether B matrices are transposed
+	count - number of products
+	a - matrices A
+	b - matrices B
+	c - result matrices of the size of the products
+*/
+void multiply_batch(bool transA, bool transB, int count, const Matrix *a,
+	const Matrix *b, Matrix *c)
+{
+	int m = transA ? a->cols : a->rows;
+	int k = transA ? a->rows : a->cols;
+	int n = transB ? b->rows : b->cols;
+	Multiply_Path path = _multiply_path(transA, transB, m, k, n);
+
+	if (count <= 0) {
+		return;
 	}
-	for (int i = 0; i < rA; ++i) {
-		result[i] = (double*)malloc(cB * sizeof(double));
-		if (result[i] == NULL) {
-			fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
-			getchar();
-			exit(1);
-		}
+	// Products of a batch are small, Strassen products run blocked
+	if (path == PATH_STRASSEN) {
+		path = PATH_BLOCKED;
 	}
+	_count_path(path, count);
 
-	if ((mid < SMALL_DIM) && (rA < SMALL_DIM) && (cB < SMALL_DIM)) {
-		// Uses standard multiplication for small sized matrices
-		for (int i = 0; i < rA; ++i) {
-			for (int j = 0; j < cB; ++j) {
-				result[i][j] = 0;
-				for (int k = 0; k < mid; ++k) {
-					result[i][j] += a[i][k] * b[k][j];
-				}
+	gemm_batch(path, transA, transB, count, a, b, 0, c);
+}
+
+/*
+	Function: gram_batch
+	---------------------
+	Calculates Gram matrices op(A[i]) transpose(op(A[i])) for a batch of
+	matrices, see syrk_batch(). Gram matrices must have the same size,
+	while inner dimensions may differ.
+
+	Parameter:
+	trans - whether A matrices are transposed, which calculates
+		transpose(A[i]) A[i]
+	count - number of matrices
+	a - matrices A
+	c - symmetric result matrices of the size of the products
+*/
+void gram_batch(bool trans, int count, const Matrix *a, Matrix *c)
+{
+	int n = trans ? a->cols : a->rows;
+
+	if (count <= 0) {
+		return;
+	}
+	_count_path(PATH_SYRK, count);
+
+	syrk_batch(trans, count, a, c);
+	for (int t = 0; t < count; ++t) {
+		for (int i = 0; i < n; ++i) {
+			for (int j = i + 1; j < n; ++j) {
+				MATRIX_AT(c[t], i, j) = MATRIX_AT(c[t], j, i);
 			}
 		}
 	}
-	else {
-		// Uses strassen algorithm
-		int *rA_t = (int*)malloc(sizeof(int));
-		int *cB_t = (int*)malloc(sizeof(int));
-		int *cA_t = (int*)malloc(sizeof(int));
-		int *rB_t = (int*)malloc(sizeof(int));
-		double **a_t = (double**)malloc(rA * sizeof(double*));
-		double **b_t = (double**)malloc(mid * sizeof(double*));
-		double **c;
-		if ((rA_t == NULL) || (cB_t == NULL) || (cA_t == NULL) || (rB_t == NULL) ||
-			(a_t == NULL) || (b_t == NULL)) {
-			fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
-			getchar();
-			exit(1);
+}
+
+/*
+	Function: _gram
+	----------------
+	Internal function. Calculates op(A) transpose(op(A)) for the Gram
+	functions. Only the lower triangle is multiplied, see syrk(), and it
+	is mirrored into the upper one.
+
+	Parameter:
+	trans - whether A is transposed
+	a - matrix A
+
+	Returns:
+	symmetric result matrix
+*/
+Matrix _gram(bool trans, const Matrix *a)
+{
+	int n = trans ? a->cols : a->rows;
+	Matrix result = matrix_new(n, n);
+
+	_count_path(PATH_SYRK, 1);
+
+	syrk(trans, a, &result);
+	for (int i = 0; i < n; ++i) {
+		for (int j = i + 1; j < n; ++j) {
+			MATRIX_AT(result, i, j) = MATRIX_AT(result, j, i);
 		}
+	}
 
-		*rA_t = rA;
-		*cB_t = cB;
-		*cA_t = mid;
-		*rB_t = mid;
-		for (int i = 0; i < rA; ++i) {
-			a_t[i] = (double*)malloc(mid * sizeof(double));
-			if (a_t[i] == NULL) {
-				fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
-				getchar();
-				exit(1);
-			}
-			for (int j = 0; j < mid; ++j) {
-				a_t[i][j] = a[i][j];
-			}
+	return result;
+}
+
+/*
+	Function: _multiply
+	--------------------
+	Internal function. Calculates op(A)op(B) into a new matrix for
+	multiply() and its transposed variants, see matrix_multiply().
+
+	Parameter:
+	transA - whether A is transposed
+	transB - whether B is transposed
+	a - matrix A
+	b - matrix B
+
+	Returns:
+	result matrix
+*/
+Matrix _multiply(bool transA, bool transB, const Matrix *a, const Matrix *b)
+{
+	Matrix result = matrix_new(transA ? a->cols : a->rows,
+		transB ? b->rows : b->cols);
+
+	matrix_multiply(&result, transA, transB, a, b);
+	return result;
+}
+
+/*
+	Function: matrix_multiply
+	--------------------------
+	Calculates op(A)op(B) into an existing matrix, where op() transposes
+	flagged operands. Every entry of the destination is written, so it
+	needs no initialization. The chosen path is counted in
+	multiply_paths.
+
+	Parameter:
+	r - destination matrix of the size of the product, may not overlap
+		the operands
+	transA - whether A is transposed
+	transB - whether B is transposed
+	a - matrix A
+	b - matrix B
+*/
+void matrix_multiply(Matrix *r, bool transA, bool transB, const Matrix *a,
+	const Matrix *b)
+{
+	int m = transA ? a->cols : a->rows;
+	int k = transA ? a->rows : a->cols;
+	int n = transB ? b->rows : b->cols;
+	Multiply_Path path = _multiply_path(transA, transB, m, k, n);
+
+	_count_path(path, 1);
+
+	switch (path) {
+	case PATH_RANK_K:
+		gemm_rows(transA, a, b, 0, r);
+		break;
+	case PATH_PANEL:
+		if (transB) {
+			gemm_dots(a, b, 0, r);
 		}
-		for (int i = 0; i < mid; ++i) {
-			b_t[i] = (double*)malloc(cB * sizeof(double));
-			if (b_t[i] == NULL) {
-				fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
-				getchar();
-				exit(1);
-			}
-			for (int j = 0; j < cB; ++j) {
-				b_t[i][j] = b[i][j];
-			}
+		else {
+			gemm_rows(transA, a, b, 0, r);
 		}
+		break;
+	case PATH_BLOCKED:
+		gemm(transA, transB, a, b, 0, r);
+		break;
+	default: {
+		// Uses strassen algorithm with one workspace for all levels
+		double *work = (double*)pool_scratch(SCRATCH_STRASSEN,
+			strassen_space(m, k, n) * sizeof(double));
+
+		strassen_multiply(transA, transB, a, b, r, work);
+		break;
+	}
+	}
+}
+
+/*
+	Function: _multiply_path
+	-------------------------
+	Internal function. Classifies a product op(A)op(B) by its shape.
+	Factor products of this program are very rectangular: the inner
+	dimension or one side of the result is usually the group number.
+	Such products are memory bound, and unpacked kernels that read
+	operands along their rows beat the packed blocked kernel. Group
+	numbers with unrolled kernels (see kernels.h) keep the unpacked
+	kernels faster up to larger sizes. Products whose dimensions all
+	exceed strassen_cutoff use Strassen.
+
+	Parameters:
+	transA - whether A is transposed
+	transB - whether B is transposed
+	m - row number of op(A)
+	k - column number of op(A)
+	n - column number of op(B)
+
+	Returns:
+	path of the product
+*/
+Multiply_Path _multiply_path(bool transA, bool transB, int m, int k, int n)
+{
+	if (!transB &&
+		((k <= MULTIPLY_RANK_K) || (group_kernels(k) != NULL))) {
+		return PATH_RANK_K;
+	}
+	if (!transB && (m <= MULTIPLY_PANEL)) {
+		return PATH_PANEL;
+	}
+	if (!transA && transB && ((n <= MULTIPLY_PANEL) ||
+		((n <= MULTIPLY_RANK_K) && (group_kernels(n) != NULL)))) {
+		return PATH_PANEL;
+	}
+	if (strassen_space(m, k, n) > 0) {
+		return PATH_STRASSEN;
+	}
+
+	return PATH_BLOCKED;
+}
+
+/*
+	Function: multiply_paths_reset
+	-------------------------------
+	Clears the counts of multiplication paths.
+*/
+void multiply_paths_reset()
+{
+	for (int i = 0; i < PATH_COUNT; ++i) {
+		multiply_paths[i] = 0;
+	}
+}
 
-		// Pads matrices
-		matrix_pad(&a_t, rA_t, cA_t);
-		matrix_pad(&b_t, rB_t, cB_t);
+/*
+	Function: _count_path
+	----------------------
+	Internal function. Counts products sent to a multiplication path.
+	Sources updated on several threads multiply at the same time, so
+	counts and the latest path are written atomically.
 
-		// Allocate result matrix space
-		c = (double**)malloc(*rA_t * sizeof(double*));
-		if (c == NULL) {
-			fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
-			getchar();
-			exit(1);
-		}
-		for (int i = 0; i < *rA_t; ++i) {
-			c[i] = (double*)malloc(*cB_t * sizeof(double));
-			if (c[i] == NULL) {
-				fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
-				getchar();
-				exit(1);
-			}
-		}
+	Parameters:
+	path - multiplication path
+	count - number of products
+*/
+void _count_path(Multiply_Path path, long count)
+{
+#ifdef _WIN32
+	_InterlockedExchangeAdd(&multiply_paths[path], count);
+	_InterlockedExchange((long volatile*)&multiply_last_path, (long)path);
+#else
+	__sync_fetch_and_add(&multiply_paths[path], count);
+	__sync_lock_test_and_set(&multiply_last_path, path);
+#endif
+}
+
+/*
+	Function: multiply_paths_print
+	-------------------------------
+	Prints how many products went through every multiplication path.
+*/
+void multiply_paths_print()
+{
+	printf("Multiplication paths:");
+	for (int i = 0; i < PATH_COUNT; ++i) {
+		printf(" %s %ld", path_names[i], multiply_paths[i]);
+	}
+	printf("\n");
+}
 
-		strassen_multiply(a_t, 0, *rA_t - 1, 0, *cA_t - 1,
-			b_t, 0, *rB_t - 1, 0, *cB_t - 1, c);
+/*
+	Function: strassen_space
+	-------------------------
+	Internal function. Calculates workspace size needed by
+	strassen_multiply() through all recursion levels.
 
-		// Restore to result matrix and clean memory
-		for (int i = 0; i < rA; ++i) {
-			for (int j = 0; j < cB; ++j) {
-				result[i][j] = c[i][j];
-			}
-		}
+	Parameters:
+	m - row number of op(A)
+	k - column number of op(A)
+	n - column number of op(B)
 
-		clear2D(&a_t, *rA_t);
-		clear2D(&b_t, *rB_t);
-		clear2D(&c, *rA_t);
-		free(rA_t);
-		free(rB_t);
-		free(cA_t);
-		free(cB_t);
+	Returns:
+	number of workspace entries, 0 if Strassen is not used
+*/
+size_t strassen_space(int m, int k, int n)
+{
+	int hm = m / 2;
+	int hk = k / 2;
+	int hn = n / 2;
+	int minDim = (m < k) ? m : k;
+	minDim = (minDim < n) ? minDim : n;
+
+	if ((minDim <= strassen_cutoff) || (minDim < 2)) {
+		return 0;
 	}
 
-	return result;
+	return (size_t)hm * ((hk > hn) ? hk : hn) + (size_t)hk * hn +
+		strassen_space(hm, hk, hn);
 }
 
 /*
 	Function: strassen_multiply
 	--------------------------
-	Internal function. Matrix multiplication through Strenssen algorithm.
-	Calculates C = AB. Dimensions of A and B must be power of 2.
+	Internal function. Matrix multiplication through Strassen-Winograd
+	algorithm. Calculates C = AB with 7 products and 15 additions per
+	level. Products are stored into quadrants of C, so one level only
+	needs two temporary matrices X and Y from the workspace. Odd
+	dimensions are peeled off and fixed by the blocked kernel, so no
+	padding is needed. Recursion stops at strassen_cutoff.
+	Transposed operands stay transposed: their quadrants are views of
+	the stored matrix, and X or Y keeps the stored orientation.
 
 	Parameters:
+	transA - whether A is transposed
+	transB - whether B is transposed
 	a - matrix A
-	rA_s - row start index of A
-	rA_e - row end index of A
-	cA_s - column start index of A
-	cA_e - column end index of A
 	b - matrix B
-	rB_s - column start index 0f B
-	rB_e - column end index of B
-	cB_s - column start index of B
-	cB_e - column end index of B
 	c - result matrix
+	work - workspace sized by strassen_space()
 */
-void strassen_multiply(
-	double **a, int rA_s, int rA_e, int cA_s, int cA_e,
-	double **b, int rB_s, int rB_e, int cB_s, int cB_e, double **c) {
-
-	if (((cA_e - cA_s) < 1) || ((rA_e - rA_s) < 1) ||
-		((cB_e - cB_s) < 1) ||
-		((cA_e - cA_s + 1 < SMALL_DIM) &&
-		(rA_e - rA_s + 1 < SMALL_DIM) &&
-		(cB_e - cB_s + 1 < SMALL_DIM))) {
-		for (int i = 0; i <= (rA_e - rA_s); ++i) {
-			for (int j = 0; j <= (cB_e - cB_s); ++j) {
-				c[i][j] = 0;
-				for (int k = 0; k <= (cA_e - cA_s); ++k) {
-					c[i][j] += a[i + rA_s][k + cA_s] * b[k + rB_s][j + cB_s];
-				}
-			}
-		}
+void strassen_multiply(bool transA, bool transB, const Matrix *a,
+	const Matrix *b, Matrix *c, double *work)
+{
+	int m = c->rows;
+	int k = transA ? a->rows : a->cols;
+	int n = c->cols;
+	int minDim = (m < k) ? m : k;
+	minDim = (minDim < n) ? minDim : n;
+
+	if ((minDim <= strassen_cutoff) || (minDim < 2)) {
+		gemm(transA, transB, a, b, 0, c);
+		return;
 	}
-	else {
-		// Intermediate matrix initialization
-		double ***m = (double***)malloc(7 * sizeof(double**));
-		double ***c_sub = (double***)malloc(4 * sizeof(double**));
-		int mR = rA_e - rA_s + 1;
-		int mC = cB_e - cB_s + 1;
-
-		for (int i = 0; i < 7; ++i) {
-			m[i] = (double**)malloc((mR / 2) * sizeof(double*));
-			for (int j = 0; j < mR / 2; ++j) {
-				m[i][j] = (double*)malloc((mC / 2) * sizeof(double));
-			}
-		}
-
-		// Gets results of 7 intermediate matrices
-		int rA_m = (rA_s + rA_e) / 2;
-		int cA_m = (cA_s + cA_e) / 2;
-		int rB_m = (rB_s + rB_e) / 2;
-		int cB_m = (cB_s + cB_e) / 2;
-		// Temporary pointers
-		double **temp1;
-		double **temp2;
-
-		// Matrix m1
-		temp1 = matrix_sum(a, rA_s, rA_m, cA_s, cA_m, rA_m + 1, rA_e,
-			cA_m + 1, cA_e);
-		temp2 = matrix_sum(b, rB_s, rB_m, cB_s, cB_m, rB_m + 1, rB_e,
-			cB_m + 1, cB_e);
-		strassen_multiply(temp1, 0, rA_m - rA_s, 0, cA_m - cA_s, temp2,
-			0, rB_m - rB_s, 0, cB_m - cB_s, m[0]);
-		clear2D(&temp1, rA_m - rA_s + 1);
-		clear2D(&temp2, rB_m - rB_s + 1);
-		// Matrix m2
-		temp1 = matrix_sum(a, rA_m + 1, rA_e, cA_s, cA_m, rA_m + 1,
-			rA_e, cA_m + 1, cA_e);
-		strassen_multiply(temp1, 0, rA_m - rA_s, 0, cA_m - cA_s,
-			b, rB_s, rB_m, cB_s, cB_m, m[1]);
-		clear2D(&temp1, rA_e - rA_m);
-		// Matrix m3
-		temp1 = matrix_sub(b, rB_s, rB_m, cB_m + 1, cB_e, rB_m + 1,
-			rB_e, cB_m + 1, cB_e);
-		strassen_multiply(a, rA_s, rA_m, cA_s, cA_m, temp1, 0,
-			rB_m - rB_s, 0, cB_m - cB_s, m[2]);
-		clear2D(&temp1, rB_m - rB_s + 1);
-		// Matrix m4
-		temp1 = matrix_sub(b, rB_m + 1, rB_e, cB_s, cB_m, rB_s, rB_m,
-			cB_s, cB_m);
-		strassen_multiply(a, rA_m + 1, rA_e, cA_m + 1, cA_e, temp1,
-			0, rB_m - rB_s, 0, cB_m - cB_s, m[3]);
-		clear2D(&temp1, rB_e - rB_m);
-		// Matrix m5
-		temp1 = matrix_sum(a, rA_s, rA_m, cA_s, cA_m, rA_s, rA_m,
-			cA_m + 1, cA_e);
-		strassen_multiply(temp1, 0, rA_m - rA_s, 0, cA_m - cA_s, b,
-			rB_m + 1, rB_e, cB_m + 1, cB_e, m[4]);
-		clear2D(&temp1, rA_m - rA_s + 1);
-		// Matrix m6
-		temp1 = matrix_sub(a, rA_m + 1, rA_e, cA_s, cA_m, rA_s, rA_m,
-			cA_s, cA_m);
-		temp2 = matrix_sum(b, rB_s, rB_m, cB_s, cB_m, rB_s, rB_m,
-			cB_m + 1, cB_e);
-		strassen_multiply(temp1, 0, rA_m - rA_s, 0, cA_m - cA_s,
-			temp2, 0, rB_m - rB_s, 0, cB_m - cB_s, m[5]);
-		clear2D(&temp1, rA_e - rA_m);
-		clear2D(&temp2, rB_m - rB_s + 1);
-		// Matrix m7
-		temp1 = matrix_sub(a, rA_s, rA_m, cA_m + 1, cA_e, rA_m + 1,
-			rA_e, cA_m + 1, cA_e);
-		temp2 = matrix_sum(b, rB_m + 1, rB_e, cB_s, cB_m, rB_m + 1,
-			rB_e, cB_m + 1, cB_e);
-		strassen_multiply(temp1, 0, rA_m - rA_s, 0, cA_m - cA_s, temp2,
-			0, rB_m - rB_s, 0, cB_m - cB_s, m[6]);
-		clear2D(&temp1, rA_m - rA_s + 1);
-		clear2D(&temp2, rB_e - rB_m);
-
-		// Calculates all result sub-matrices
-		temp1 = sum(m[0], m[3], mR / 2, mC / 2);
-		temp2 = sub(temp1, m[4], mR / 2, mC / 2);
-		c_sub[0] = sum(temp2, m[6], mR / 2, mC / 2);
-		clear2D(&temp1, mR / 2);
-		clear2D(&temp2, mR / 2);
-		c_sub[1] = sum(m[2], m[4], mR / 2, mC / 2);
-		c_sub[2] = sum(m[1], m[3], mR / 2, mC / 2);
-		temp1 = sum(m[0], m[2], mR / 2, mC / 2);
-		temp2 = sum(temp1, m[5], mR / 2, mC / 2);
-		c_sub[3] = sub(temp2, m[1], mR / 2, mC / 2);
-		clear2D(&temp1, mR / 2);
-		clear2D(&temp2, mR / 2);
-
-		// Free intermediate matrices
-		for (int i = 0; i < 7; ++i) {
-			for (int j = 0; j < mR / 2; ++j) {
-				free(m[i][j]);
-			}
-			free(m[i]);
-		}
-		free(m);
-
-		// Combine sub-matrices
-		for (int i = 0; i < 4; ++i) {
-			for (int j = 0; j < mR / 2; ++j) {
-				for (int k = 0; k < mC / 2; ++k) {
-					c[(i / 2) * mR / 2 + j][(i % 2) * mC / 2 + k] =
-						c_sub[i][j][k];
-				}
-			}
-		}
 
-		// Free sub mmatrices
-		for (int i = 0; i < 4; ++i) {
-			for (int j = 0; j < mR / 2; ++j) {
-				free(c_sub[i][j]);
-			}
-			free(c_sub[i]);
-		}
-		free(c_sub);
+	int hm = m / 2;
+	int hk = k / 2;
+	int hn = n / 2;
+	// Quadrant views of the even sized cores of A, B and C
+	Matrix a11 = _op_view(a, transA, 0, 0, hm, hk);
+	Matrix a12 = _op_view(a, transA, 0, hk, hm, hk);
+	Matrix a21 = _op_view(a, transA, hm, 0, hm, hk);
+	Matrix a22 = _op_view(a, transA, hm, hk, hm, hk);
+	Matrix b11 = _op_view(b, transB, 0, 0, hk, hn);
+	Matrix b12 = _op_view(b, transB, 0, hn, hk, hn);
+	Matrix b21 = _op_view(b, transB, hk, 0, hk, hn);
+	Matrix b22 = _op_view(b, transB, hk, hn, hk, hn);
+	Matrix c11 = matrix_view(c, 0, 0, hm, hn);
+	Matrix c12 = matrix_view(c, 0, hn, hm, hn);
+	Matrix c21 = matrix_view(c, hm, 0, hm, hn);
+	Matrix c22 = matrix_view(c, hm, hn, hm, hn);
+	// X holds sums of A, then P1. Y holds sums of B.
+	size_t xSize = (size_t)hm * ((hk > hn) ? hk : hn);
+	Matrix xa = transA ? matrix_wrap(work, hk, hm) : matrix_wrap(work, hm, hk);
+	Matrix xc = matrix_wrap(work, hm, hn);
+	Matrix y = transB ? matrix_wrap(work + xSize, hn, hk) :
+		matrix_wrap(work + xSize, hk, hn);
+	double *next = work + xSize + (size_t)hk * hn;
+	const double ones[3] = { 1, 1, 1 };
+	const Matrix *u5[3] = { &c12, &c22, &c11 };
+
+	matrix_sub(&xa, &a11, &a21);	// S3 = A11 - A21
+	matrix_sub(&y, &b22, &b12);	// T3 = B22 - B12
+	strassen_multiply(transA, transB, &xa, &y, &c21, next);	// P7 = S3 T3
+	matrix_add(&xa, &a21, &a22);	// S1 = A21 + A22
+	matrix_sub(&y, &b12, &b11);	// T1 = B12 - B11
+	strassen_multiply(transA, transB, &xa, &y, &c22, next);	// P5 = S1 T1
+	matrix_sub(&y, &b22, &y);	// T2 = B22 - T1
+	matrix_sub(&xa, &xa, &a11);	// S2 = S1 - A11
+	strassen_multiply(transA, transB, &xa, &y, &c12, next);	// P6 = S2 T2
+	matrix_sub(&xa, &a12, &xa);	// S4 = A12 - S2
+	strassen_multiply(transA, transB, &xa, &b22, &c11, next);	// P3 = S4 B22
+	strassen_multiply(transA, transB, &a11, &b11, &xc, next);	// P1 = A11 B11
+	matrix_add(&c12, &xc, &c12);	// U2 = P1 + P6
+	matrix_add(&c21, &c12, &c21);	// U3 = U2 + P7
+	matrix_combine(&c12, 3, ones, u5);	// U5 = U2 + P5 + P3, C12
+	matrix_add(&c22, &c21, &c22);	// U7 = U3 + P5, C22
+	matrix_sub(&y, &y, &b21);	// T4 = T2 - B21
+	strassen_multiply(transA, transB, &a22, &y, &c11, next);	// P4 = A22 T4
+	matrix_sub(&c21, &c21, &c11);	// U6 = U3 - P4, C21
+	strassen_multiply(transA, transB, &a12, &b21, &c11, next);	// P2 = A12 B21
+	matrix_add(&c11, &xc, &c11);	// U1 = P1 + P2, C11
+
+	// Dynamic peeling of odd dimensions
+	if (k > 2 * hk) {
+		// Rank one update of the core by the last column of A
+		Matrix aCol = _op_view(a, transA, 0, k - 1, 2 * hm, 1);
+		Matrix bRow = _op_view(b, transB, k - 1, 0, 1, 2 * hn);
+		Matrix core = matrix_view(c, 0, 0, 2 * hm, 2 * hn);
+		gemm(transA, transB, &aCol, &bRow, 1, &core);
+	}
+	if (n > 2 * hn) {
+		// Last column of C
+		Matrix bCol = _op_view(b, transB, 0, n - 1, k, 1);
+		Matrix cCol = matrix_view(c, 0, n - 1, m, 1);
+		gemm(transA, transB, a, &bCol, 0, &cCol);
 	}
+	if (m > 2 * hm) {
+		// Last row of C
+		Matrix aRow = _op_view(a, transA, m - 1, 0, 1, k);
+		Matrix cRow = matrix_view(c, m - 1, 0, 1, 2 * hn);
+		Matrix bCore = _op_view(b, transB, 0, 0, k, 2 * hn);
+		gemm(transA, transB, &aRow, &bCore, 0, &cRow);
+	}
+}
+
+/*
+	Function: _op_view
+	-------------------
+	Internal function. Views a block of op(A), where op() transposes A
+	when the flag is set. The view is taken from the stored matrix, so
+	a transposed block is returned untransposed.
+
+	Parameters:
+	a - matrix A
+	trans - whether A is transposed
+	r - first row of the block in op(A)
+	c - first column of the block in op(A)
+	rows - row number of the block in op(A)
+	cols - column number of the block in op(A)
+
+	Returns:
+	view of the block
+*/
+Matrix _op_view(const Matrix *a, bool trans, int r, int c, int rows,
+	int cols)
+{
+	return trans ? matrix_view(a, c, r, cols, rows) :
+		matrix_view(a, r, c, rows, cols);
 }
 
 /*
@@ -307,33 +1044,15 @@ void strassen_multiply(
 	Parameters:
 	a - matrix A
 	b - matrix B
-	r - row number
-	c - column number
 
 	Returns:
 	result matrix
 */
-double** sum(double **a, double **b, int r, int c)
+Matrix sum(const Matrix *a, const Matrix *b)
 {
-	double **result = (double**)malloc(r * sizeof(double*));
-	if (result == NULL) {
-		fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
-		getchar();
-		exit(1);
-	}
-
-	for (int i = 0; i < r; ++i) {
-		result[i] = (double*)malloc(c * sizeof(double));
-		if (result[i] == NULL) {
-			fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
-			getchar();
-			exit(1);
-		}
-		for (int j = 0; j < c; ++j) {
-			result[i][j] = a[i][j] + b[i][j];
-		}
-	}
+	Matrix result = matrix_new(a->rows, a->cols);
 
+	matrix_add(&result, a, b);
 	return result;
 }
 
@@ -345,33 +1064,15 @@ double** sum(double **a, double **b, int r, int c)
 	Parameters:
 	a - matrix A
 	b - matrix B
-	r - row number
-	c - column number
 
 	Returns:
 	result matrix
 */
-double** sub(double **a, double **b, int r, int c)
+Matrix sub(const Matrix *a, const Matrix *b)
 {
-	double **result = (double**)malloc(r * sizeof(double*));
-	if (result == NULL) {
-		fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
-		getchar();
-		exit(1);
-	}
-
-	for (int i = 0; i < r; ++i) {
-		result[i] = (double*)malloc(c * sizeof(double));
-		if (result[i] == NULL) {
-			fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
-			getchar();
-			exit(1);
-		}
-		for (int j = 0; j < c; ++j) {
-			result[i][j] = a[i][j] - b[i][j];
-		}
-	}
+	Matrix result = matrix_new(a->rows, a->cols);
 
+	matrix_sub(&result, a, b);
 	return result;
 }
 
@@ -382,119 +1083,343 @@ double** sub(double **a, double **b, int r, int c)
 
 	Parameters:
 	a - matrix to be transposed
-	r - row number
-	c - column number
 
 	Return:
 	Transposed matrix
  */
-double** transpose(double **a, int r, int c)
+Matrix transpose(const Matrix *a)
 {
-	double **trans = (double**)malloc(c * sizeof(double*));
-	if (trans == NULL) {
-		fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
-		getchar();
-		exit(1);
-	}
+	Matrix trans = matrix_new(a->cols, a->rows);
 
-	for (int i = 0; i < c; ++i) {
-		trans[i] = (double*)malloc(r * sizeof(double));
-		if (trans[i] == NULL) {
-			fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
-			getchar();
-			exit(1);
-		}
-		for (int j = 0; j < r; ++j) {
-			trans[i][j] = a[j][i];
+	matrix_transpose(&trans, a);
+	return trans;
+}
+
+/*
+	Function: matrix_transpose
+	---------------------------
+	Transposes a matrix into an existing matrix. Strips of
+	TRANSPOSE_STRIP rows of A are transposed in parallel, and every
+	strip is halved recursively until blocks fit L1, so both A and R are
+	walked in cache friendly blocks of any cache size. Results larger
+	than TRANSPOSE_STREAM are written by streaming stores when R is
+	aligned, so that they do not evict the operands from the caches.
+	A matrix A which is not double is transposed entry by entry.
+
+	Parameters:
+	r - destination matrix, transpose(A)
+	a - matrix A
+*/
+void matrix_transpose(Matrix *r, const Matrix *a)
+{
+	Transpose_Job job;
+
+	if (a->type != MATRIX_F64) {
+		for (int i = 0; i < a->rows; ++i) {
+			for (int j = 0; j < a->cols; ++j) {
+				MATRIX_AT(*r, j, i) = MATRIX_GET(*a, i, j);
+			}
 		}
+		return;
 	}
 
-	return trans;
+	job.a = a;
+	job.r = r;
+	// Streaming stores write aligned vectors of 4 entries
+	job.stream = ((double)a->rows * a->cols * sizeof(double) >
+		TRANSPOSE_STREAM) && (r->ld % 4 == 0) &&
+		((size_t)MATRIX_ROW(*r, 0) % (4 * sizeof(double)) == 0);
+	parallel_for((a->rows + TRANSPOSE_STRIP - 1) / TRANSPOSE_STRIP,
+		_transpose_strip, &job);
 }
 
 /*
-	Function: eigen
-	----------------
-	Internal function. Find the largest eigenvalue from the matrix.
+	Function: _transpose_strip
+	---------------------------
+	Internal function. Loop body of matrix_transpose(), transposes strips
+	of rows of A from begin to end - 1.
+
+	Parameters:
+	arg - transpose job
+	begin - first strip
+	end - one after last strip
+*/
+void _transpose_strip(void *arg, int begin, int end)
+{
+	Transpose_Job *job = (Transpose_Job*)arg;
+
+	for (int t = begin; t < end; ++t) {
+		int i0 = t * TRANSPOSE_STRIP;
+		int rows = (job->a->rows - i0 < TRANSPOSE_STRIP) ?
+			job->a->rows - i0 : TRANSPOSE_STRIP;
+
+		_transpose_block(MATRIX_ROW(*job->a, i0), job->a->ld,
+			&MATRIX_AT(*job->r, 0, i0), job->r->ld, rows, job->a->cols,
+			job->stream);
+	}
+}
+
+/*
+	Function: _transpose_block
+	---------------------------
+	Internal function. Cache oblivious transpose of a block. The longer
+	side is halved until the block fits TRANSPOSE_TILE, halves stay
+	multiples of 4 so that register blocks of the kernel are not split.
+
+	Parameters:
+	a - first entry of the block of A
+	lda - leading dimension of A
+	r - first entry of the transposed block in R
+	ldr - leading dimension of R
+	rows - row number of the block of A
+	cols - column number of the block of A
+	stream - whether R is written around the caches
+*/
+void _transpose_block(const double *a, size_t lda, double *r, size_t ldr,
+	int rows, int cols, bool stream)
+{
+	if ((rows <= TRANSPOSE_TILE) && (cols <= TRANSPOSE_TILE)) {
+		simd.transpose(a, lda, r, ldr, rows, cols, stream);
+	}
+	else if (rows >= cols) {
+		int half = (rows / 2 + 3) / 4 * 4;
+		_transpose_block(a, lda, r, ldr, half, cols, stream);
+		_transpose_block(a + half * lda, lda, r + half, ldr, rows - half,
+			cols, stream);
+	}
+	else {
+		int half = (cols / 2 + 3) / 4 * 4;
+		_transpose_block(a, lda, r, ldr, rows, half, stream);
+		_transpose_block(a + half, lda, r + half * ldr, ldr, rows,
+			cols - half, stream);
+	}
+}
+
+/*
+	Function: spectral2
+	--------------------
+	Calculates the squared spectral norm of a matrix, the largest
+	eigenvalue of transpose(A) A, by Lanczos iteration. The Gram matrix
+	is never built: every step multiplies a vector by A and then by
+	transpose(A). Lanczos vectors are kept orthogonal and the Ritz pair
+	is checked after every step, so a good start vector converges in a
+	few steps. Steps are restarted from the latest Ritz vector after
+	SPECTRAL_STEPS, at most SPECTRAL_RESTARTS times.
 
 	Parameters:
-	a - square matrix to be calculated
-	n - dimension of its column/row space
+	a - a matrix of any storage type
+	v - start vector of A->cols entries, replaced by the dominant right
+		singular vector. A zero vector starts from a fixed vector.
 
 	Returns:
-	the largest eigenvalue
+	squared spectral norm
 */
-double eigenL(double **a, int n)
+double spectral2(const Matrix *a, double *v)
 {
-	int parity = 0;	// Parity of loop rounds 
-	double result = 0;
-	double norm = 0;
-	double **eigV = (double**)malloc(2 * sizeof(double*));
-	double *temp = (double*)malloc(n * sizeof(double));
-	if ((eigV == NULL) || temp == NULL) {
-		fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
-		getchar();
-		exit(1);
+	int n = a->cols;
+	int m = (n < SPECTRAL_STEPS) ? n : SPECTRAL_STEPS;
+	// Lanczos vectors, one more than steps, and a product with A
+	double *q = (double*)pool_scratch(SCRATCH_EIGEN,
+		((size_t)(m + 1) * n + a->rows) * sizeof(double));
+	double *u = q + (size_t)(m + 1) * n;
+	double alpha[SPECTRAL_STEPS];
+	double beta[SPECTRAL_STEPS];
+	double ritz[SPECTRAL_STEPS];
+	double theta = 0;
+	double length;
+
+	if ((n == 0) || (a->rows == 0)) {
+		return 0;
 	}
 
-	// Initialization
-	for (int i = 0; i < 2; ++i) {
-		eigV[i] = (double*)malloc(n * sizeof(double));
-		if (eigV[i] == NULL) {
-			fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
-			getchar();
-			exit(1);
-		}
+	length = sqrt(simd.dot(v, v, n));
+	if (length == 0) {
+		// Varied entries keep the start away from orthogonal vectors
 		for (int j = 0; j < n; ++j) {
-			eigV[i][j] = i;
+			v[j] = 1.0 + (double)((j * 7919) % 101) / 101.0;
 		}
+		length = sqrt(simd.dot(v, v, n));
 	}
-	int loop = 0;
-	// Find approximate eigenvector
-	while (euclidean_dist(
-		eigV[(parity + 1) % 2], eigV[parity], n) > 1.0e-10) {
-		for (int i = 0; i < n; ++i) {
-			temp[i] = 0;
-			for (int j = 0; j < n; ++j) {
-				temp[i] += a[i][j] * eigV[(parity + 1) % 2][j];
+
+	for (int restart = 0; restart <= SPECTRAL_RESTARTS; ++restart) {
+		int steps = 0;
+		bool done = false;
+
+		for (int j = 0; j < n; ++j) {
+			q[j] = v[j] / length;
+		}
+		while (!done && (steps < m)) {
+			double *qj = q + (size_t)steps * n;
+			double *w = qj + n;
+
+			_gram_apply(a, qj, u, w);
+			alpha[steps] = simd.dot(qj, w, n);
+			// Full orthogonalization, twice for stability
+			for (int pass = 0; pass < 2; ++pass) {
+				for (int i = 0; i <= steps; ++i) {
+					double *qi = q + (size_t)i * n;
+					simd.axpy(w, -simd.dot(qi, w, n), qi, n);
+				}
+			}
+			beta[steps] = sqrt(simd.dot(w, w, n));
+			++steps;
+
+			theta = _lanczos_ritz(alpha, beta, steps, ritz);
+			// Residual of the Ritz pair, zero for an invariant subspace
+			done = (fabs(beta[steps - 1] * ritz[steps - 1]) <=
+				SPECTRAL_TOL * theta) || (theta == 0);
+			if (!done && (beta[steps - 1] > 0)) {
+				for (int j = 0; j < n; ++j) {
+					w[j] /= beta[steps - 1];
+				}
+			}
+			else {
+				done = true;
 			}
-			norm += pow(temp[i], 2);
 		}
-		norm = sqrt(norm);
 
-		if (norm != 0) {
-			// Normalization
-			for (int i = 0; i < n; ++i) {
-				eigV[parity][i] = temp[i] / norm;
-			}
-			++parity;
-			parity = parity % 2;
+		// Ritz vector of theta
+		for (int j = 0; j < n; ++j) {
+			v[j] = 0;
 		}
-		else {
-			// This is a null space
+		for (int i = 0; i < steps; ++i) {
+			simd.axpy(v, ritz[i], q + (size_t)i * n, n);
+		}
+		length = sqrt(simd.dot(v, v, n));
+		if (done || (length == 0)) {
 			break;
 		}
 	}
+	if (length > 0) {
+		for (int j = 0; j < n; ++j) {
+			v[j] /= length;
+		}
+	}
 
-	// Find eigenvalue
-	int count = 0;
-	for (int i = 0; i < n; ++i) {
-		if (eigV[(parity + 1) % 2][i] != 0) {
-			temp[i] = 0;
-			for (int j = 0; j < n; ++j) {
-				temp[i] += a[i][j] * eigV[(parity + 1) % 2][j];
+	return theta;
+}
+
+/*
+	Function: _gram_apply
+	----------------------
+	Internal function. Multiplies a vector by transpose(A) A through A
+	and transpose(A).
+
+	Parameters:
+	a - a matrix of any storage type
+	x - vector of A->cols entries
+	u - space of A->rows entries for A x
+	y - result vector of A->cols entries
+*/
+void _gram_apply(const Matrix *a, const double *x, double *u, double *y)
+{
+	double *buffer = _read_buffer(a, a->cols, SCRATCH_READ_A);
+
+	for (int i = 0; i < a->rows; ++i) {
+		u[i] = simd.dot(matrix_read(a, i, 0, a->cols, buffer), x, a->cols);
+	}
+	for (int j = 0; j < a->cols; ++j) {
+		y[j] = 0;
+	}
+	for (int i = 0; i < a->rows; ++i) {
+		simd.axpy(y, u[i], matrix_read(a, i, 0, a->cols, buffer), a->cols);
+	}
+}
+
+/*
+	Function: _lanczos_ritz
+	------------------------
+	Internal function. Finds the largest eigenvalue of the tridiagonal
+	Lanczos matrix and its eigenvector by cyclic Jacobi rotations.
+
+	Parameters:
+	alpha - diagonal of the tridiagonal matrix
+	beta - off diagonal, beta[i] joins entries i and i + 1
+	m - size of the tridiagonal matrix
+	y - eigenvector of the largest eigenvalue
+
+	Returns:
+	largest eigenvalue
+*/
+double _lanczos_ritz(const double *alpha, const double *beta, int m,
+	double *y)
+{
+	double t[SPECTRAL_STEPS][SPECTRAL_STEPS];
+	double e[SPECTRAL_STEPS][SPECTRAL_STEPS];
+	int best = 0;
+
+	for (int i = 0; i < m; ++i) {
+		for (int j = 0; j < m; ++j) {
+			t[i][j] = (i == j) ? alpha[i] :
+				(j == i + 1) ? beta[i] : (i == j + 1) ? beta[j] : 0;
+			e[i][j] = (i == j) ? 1 : 0;
+		}
+	}
+
+	for (int sweep = 0; sweep < 50; ++sweep) {
+		double off = 0;
+		double all = 0;
+
+		for (int i = 0; i < m; ++i) {
+			for (int j = 0; j < m; ++j) {
+				all += t[i][j] * t[i][j];
+				if (i != j) {
+					off += t[i][j] * t[i][j];
+				}
+			}
+		}
+		if (off <= 1.0e-30 * all) {
+			break;
+		}
+
+		for (int p = 0; p < m - 1; ++p) {
+			for (int r = p + 1; r < m; ++r) {
+				double zeta;
+				double tangent;
+				double c;
+				double sn;
+
+				if (t[p][r] == 0) {
+					continue;
+				}
+				// Rotation zeroing t[p][r]
+				zeta = (t[r][r] - t[p][p]) / (2 * t[p][r]);
+				tangent = ((zeta >= 0) ? 1.0 : -1.0) /
+					(fabs(zeta) + sqrt(1 + zeta * zeta));
+				c = 1 / sqrt(1 + tangent * tangent);
+				sn = tangent * c;
+				for (int k = 0; k < m; ++k) {
+					double tp = t[k][p];
+					double tr = t[k][r];
+					t[k][p] = c * tp - sn * tr;
+					t[k][r] = sn * tp + c * tr;
+				}
+				for (int k = 0; k < m; ++k) {
+					double tp = t[p][k];
+					double tr = t[r][k];
+					t[p][k] = c * tp - sn * tr;
+					t[r][k] = sn * tp + c * tr;
+				}
+				for (int k = 0; k < m; ++k) {
+					double ep = e[k][p];
+					double er = e[k][r];
+					e[k][p] = c * ep - sn * er;
+					e[k][r] = sn * ep + c * er;
+				}
 			}
-			result += temp[i] / eigV[(parity + 1) % 2][i];
-			++count;
 		}
 	}
-	if (count != 0) {
-		result = result / count;
+
+	for (int i = 1; i < m; ++i) {
+		if (t[i][i] > t[best][best]) {
+			best = i;
+		}
+	}
+	for (int i = 0; i < m; ++i) {
+		y[i] = e[i][best];
 	}
 
-	clear2D(&eigV, 2);
-	free(temp);
-	return result;
+	return t[best][best];
 }
 
 /*
@@ -504,206 +1429,229 @@ double eigenL(double **a, int n)
 
 	Parameters:
 	a - a matrix
-	r - row number
-	c - column number
 
 	Returns:
 	entrywise norm of this matrix
 */
-double norm(double **a, int r, int c)
+double norm(const Matrix *a)
 {
-	return sqrt(norm2(a, r, c));
+	return sqrt(norm2(a));
 }
 
 /*
 	Function: norm2
 	---------------------
-	Calculates matrix's squared value of its 2-norm.
+	Calculates matrix's squared value of its 2-norm, see spectral2().
 
 	Parameters:
 	a - a matrix
-	r - row number
-	c - column number
 
 	Returns:
 	entrywise norm of this matrix
 */
-double norm2(double **a, int r, int c)
+double norm2(const Matrix *a)
 {
-	double result = 0;
-	double **temp = transpose(a, r, c);
-	double **sqr = multiply(temp, c, a, c, r);
-	result = eigenL(sqr, c);
+	double *v = (double*)pool_scratch(SCRATCH_START,
+		(size_t)a->cols * sizeof(double));
 
-	clear2D(&temp, c);
-	clear2D(&sqr, c);
-	return result;
+	for (int j = 0; j < a->cols; ++j) {
+		v[j] = 0;
+	}
+	return spectral2(a, v);
 }
 
 /*
-	Function: euclidean_dist
-	-------------------------
-	Internal function. Calculates distance between two vectors.
+	Function: frobenius2
+	---------------------
+	Calculates the squared Frobenius norm of a matrix. A may be of any
+	storage type.
 
 	Parameters:
-	a - vector A
-	b - vector b
-	dim - dimension of vector
+	a - a matrix
 
 	Returns:
-	result euclidean distance
+	sum of squares of all entries
 */
-double euclidean_dist(double *a, double *b, int dim)
+double frobenius2(const Matrix *a)
 {
-	double dist = 0;
-
-	for (int i = 0; i < dim; ++i) {
-		dist += pow(a[i] - b[i], 2);
-	}
-	dist = sqrt(dist);
-
-	return dist;
+	return matrix_inner(a, a);
 }
 
 /*
-	Function: matrix_sum
-	---------------------
-	Internal function. Adds a sub matrix from another internally.
+	Function: matrix_inner
+	-----------------------
+	Calculates the inner product of two matrices of one size, the sum of
+	products of their corresponding entries, or tr(transpose(A) B).
+	Operands may be of any storage type.
 
 	Parameters:
 	a - matrix A
-	r1_s - start row index of the first sub matrix
-	r1_e - end row index of the first sub matrix
-	c1_s - start column index of the first  sub matrix
-	c1_e - end column index of the first sub matrix
-	r2_s - start row index of the second sub matrix
-	r2_e - end row index of the second sub matrix
-	c2_s - start column index of the second sub matrix
-	c2_e - end column index of the second sub matrix
+	b - matrix B
 
 	Returns:
-	result matrix
+	inner product
 */
-double** matrix_sum(double **a, int r1_s, int r1_e, int c1_s, int c1_e,
-	int r2_s, int r2_e, int c2_s, int c2_e)
+double matrix_inner(const Matrix *a, const Matrix *b)
 {
-	int rSize = r1_e - r1_s + 1;
-	int cSize = c1_e - c1_s + 1;
-	double **result = (double**)malloc(rSize * sizeof(double*));
-	if (result == NULL) {
-		fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
-		getchar();
-		exit(1);
-	}
+	double result = 0;
+	double *bufA = _read_buffer(a, a->cols, SCRATCH_READ_A);
+	double *bufB = (b == a) ? NULL : _read_buffer(b, a->cols,
+		SCRATCH_READ_B);
 
-	for (int i = 0; i < rSize; ++i) {
-		result[i] = (double*)malloc(cSize * sizeof(double));
-		if (result[i] == NULL) {
-			fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
-			getchar();
-			exit(1);
-		}
-		for (int j = 0; j < cSize; ++j) {
-			result[i][j] = a[i + r1_s][j + c1_s] + a[i + r2_s][j + c2_s];
-		}
+	for (int i = 0; i < a->rows; ++i) {
+		const double *rowA = matrix_read(a, i, 0, a->cols, bufA);
+		const double *rowB = (b == a) ? rowA :
+			matrix_read(b, i, 0, a->cols, bufB);
+
+		result += simd.dot(rowA, rowB, a->cols);
 	}
 
 	return result;
 }
 
 /*
-	Function: matrix_sub
+	Function: matrix_add
 	---------------------
-	Internal function. Substracts a sub matrix from another 
-	internally.
+	Adds two matrices into a destination matrix. Destination may be one
+	of the operands. Operands may be of any storage type.
 
 	Parameters:
+	r - destination matrix
 	a - matrix A
-	r1_s - start row index of the first sub matrix
-	r1_e - end row index of the first sub matrix
-	c1_s - start column index of the first  sub matrix
-	c1_e - end column index of the first sub matrix
-	r2_s - start row index of the second sub matrix
-	r2_e - end row index of the second sub matrix
-	c2_s - start column index of the second sub matrix
-	c2_e - end column index of the second sub matrix
-
-	Returns:
-	result matrix
+	b - matrix B
 */
-double** matrix_sub(double **a, int r1_s, int r1_e, int c1_s, int c1_e,
-	int r2_s, int r2_e, int c2_s, int c2_e)
+void matrix_add(Matrix *r, const Matrix *a, const Matrix *b)
 {
-	int rSize = r1_e - r1_s + 1;
-	int cSize = c1_e - c1_s + 1;
-	double **result = (double**)malloc(rSize * sizeof(double*));
-	if (result == NULL) {
-		fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
-		getchar();
-		exit(1);
+	double *bufA = _read_buffer(a, r->cols, SCRATCH_READ_A);
+	double *bufB = _read_buffer(b, r->cols, SCRATCH_READ_B);
+
+	for (int i = 0; i < r->rows; ++i) {
+		simd.add(matrix_read(a, i, 0, r->cols, bufA),
+			matrix_read(b, i, 0, r->cols, bufB), MATRIX_ROW(*r, i), r->cols);
 	}
+}
 
-	for (int i = 0; i < rSize; ++i) {
-		result[i] = (double*)malloc(cSize * sizeof(double));
-		for (int j = 0; j < cSize; ++j) {
-			result[i][j] = a[i + r1_s][j + c1_s] - a[i + r2_s][j + c2_s];
-		}
+/*
+	Function: matrix_sub
+	---------------------
+	Substracts matrix B from matrix A into a destination matrix.
+	Destination may be one of the operands. Operands may be of any
+	storage type.
+
+	Parameters:
+	r - destination matrix
+	a - matrix A
+	b - matrix B
+*/
+void matrix_sub(Matrix *r, const Matrix *a, const Matrix *b)
+{
+	double *bufA = _read_buffer(a, r->cols, SCRATCH_READ_A);
+	double *bufB = _read_buffer(b, r->cols, SCRATCH_READ_B);
+
+	for (int i = 0; i < r->rows; ++i) {
+		simd.sub(matrix_read(a, i, 0, r->cols, bufA),
+			matrix_read(b, i, 0, r->cols, bufB), MATRIX_ROW(*r, i), r->cols);
 	}
+}
 
-	return result;
+/*
+	Function: matrix_axpy
+	----------------------
+	Adds a scaled matrix to a destination matrix, Y = Y + alpha * X.
+	X may be of any storage type.
+
+	Parameters:
+	y - destination matrix Y
+	alpha - scaling of X
+	x - matrix X
+*/
+void matrix_axpy(Matrix *y, double alpha, const Matrix *x)
+{
+	double *buffer = _read_buffer(x, y->cols, SCRATCH_READ_A);
+
+	for (int i = 0; i < y->rows; ++i) {
+		simd.axpy(MATRIX_ROW(*y, i), alpha,
+			matrix_read(x, i, 0, y->cols, buffer), y->cols);
+	}
 }
 
 /*
-	Function: Matrix_pad
-	---------------------
-	Internal function. Pad 0s to this target matrix, so that the number
-	of rows and columns	comes to the power of 2.
+	Function: matrix_combine
+	-------------------------
+	Linear combination of several matrices in one pass, R = sum of
+	coef[t] * terms[t]. Every row of R is built from all terms while it
+	stays in cache, so a chain of additions and substractions writes R
+	only once. Terms are added in their order, a coefficient of 1 or -1
+	rounds like plain addition or substraction. R may be one of the
+	terms, but may not overlap them otherwise. Terms may be of any
+	storage type.
 
 	Parameters:
-	a - target matrix
-	r - row number
-	c - column number
+	r - destination matrix
+	count - number of terms
+	coef - coefficients of terms
+	terms - matrices
 */
-void matrix_pad(double ***a, int *r, int *c) {
-	int rPad = (int)pow(2, ceil(log2(*r)));
-	int cPad = (int)pow(2, ceil(log2(*c)));
-
-	// Extends matrix allocation
-	if (cPad > *c) {
-		for (int i = 0; i < *r; ++i) {
-			a[0][i] = (double*)realloc(a[0][i], cPad * sizeof(double));
-			if (a[0][i] == NULL) {
-				fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
-				getchar();
-				exit(1);
-			}
-			for (int j = *c; j < cPad; ++j) {
-				a[0][i][j] = 0;	// Pads columns
-			}
+void matrix_combine(Matrix *r, int count, const double *coef,
+	const Matrix *const *terms)
+{
+	// Term stored in R, which has to be used before R is written
+	int self = -1;
+	double *buffer = NULL;
+
+	for (int t = 0; t < count; ++t) {
+		if ((terms[t]->data == r->data) && (terms[t]->offset == r->offset)) {
+			self = t;
+			break;
 		}
 	}
-	if (rPad > *r) {
-		a[0] = (double**)realloc(a[0], rPad * sizeof(double*));
-		if (a[0] == NULL) {
-			fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
-			getchar();
-			exit(1);
-		}
+	for (int t = 0; (t < count) && (buffer == NULL); ++t) {
+		buffer = _read_buffer(terms[t], r->cols, SCRATCH_READ_A);
+	}
 
-		for (int i = *r; i < rPad; ++i) {
-			a[0][i] = (double*)malloc(cPad * sizeof(double));
-			if (a[0][i] == NULL) {
-				fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
-				getchar();
-				exit(1);
-			}
+	for (int i = 0; i < r->rows; ++i) {
+		double *rowR = MATRIX_ROW(*r, i);
+		int first = (self < 0) ? 0 : self;
 
-			for (int j = 0; j < cPad; ++j) {
-				a[0][i][j] = 0;	// Pads rows
+		if (self < 0) {
+			for (int j = 0; j < r->cols; ++j) {
+				rowR[j] = 0;
+			}
+			simd.axpy(rowR, coef[0],
+				matrix_read(terms[0], i, 0, r->cols, buffer), r->cols);
+		}
+		else if (coef[self] != 1) {
+			for (int j = 0; j < r->cols; ++j) {
+				rowR[j] *= coef[self];
+			}
+		}
+		for (int t = 0; t < count; ++t) {
+			if (t != first) {
+				simd.axpy(rowR, coef[t],
+					matrix_read(terms[t], i, 0, r->cols, buffer), r->cols);
 			}
 		}
 	}
+}
+
+/*
+	Function: matrix_split
+	-----------------------
+	Splits a matrix into its positive and negative parts in one pass.
+	Entries of A go to either part, and the other part gets zero. A may
+	be of any storage type.
+
+	Parameters:
+	a - matrix A
+	pos - destination of the positive part
+	neg - destination of the negative part
+*/
+void matrix_split(const Matrix *a, Matrix *pos, Matrix *neg)
+{
+	double *buffer = _read_buffer(a, a->cols, SCRATCH_READ_A);
 
-	*r = rPad;
-	*c = cPad;
-}
\ No newline at end of file
+	for (int i = 0; i < a->rows; ++i) {
+		simd.split(matrix_read(a, i, 0, a->cols, buffer),
+			MATRIX_ROW(*pos, i), MATRIX_ROW(*neg, i), a->cols);
+	}
+}
@@ -1,189 +1,458 @@
 #include "algorithms.h"
 #include "utility.h"
+#include "simd.h"
+#include "kernels.h"
+#include "threadpool.h"
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #define MAX_LOOP 700
+// Rows of W and columns of H of one parallel task of the updates, both
+// multiples of 8 doubles so that tasks start on their own cache lines
+#define UPDATE_ROWS 512
+#define UPDATE_COLS 4096
 
-double **_getW(double**, int, int);
-double** _sumH(Source*, int);
-double** _n_sumH(Source*, int);
+// Products and updates of all sources in one iteration, see
+// _source_products() and _source_updates()
+typedef struct Source_Job
+{
+	Source *src;
+	double alpha;	// Weight of differences between H matrices
+	int size;	// Number of sources
+	const int *order;	// Sources by decreasing work
+	Matrix *temps;	// Products W H transpose(H) of every source
+	const Matrix *hh;
+	Matrix *wwhs;
+	Matrix *vhs;
+	Matrix *wvs;
+	const Sparse *rated;
+	Sparse *pred;
+	double *fits;	// Squared residuals of masked sources
+	const Matrix *sum_h;
+	const Matrix *n_sum_h;
+	const Group_Kernels *group;	// Kernels unrolled by group number
+} Source_Job;
+
+// Update of the W and H of one source, see _update_rows() and
+// _update_cols()
+typedef struct Update_Job
+{
+	Source *s;
+	const Matrix *vh;	// V transpose(H)
+	const Matrix *whh;	// W H transpose(H)
+	const Matrix *wv;	// transpose(W) V
+	const Matrix *wwh;	// transpose(W) W H
+	const Matrix *sum_h;
+	const Matrix *n_sum_h;
+	double alpha;	// Weight of differences between H matrices
+	double weight;	// Weight of the H itself, alpha times sources
+	const Group_Kernels *group;	// Kernels unrolled by group number
+} Update_Job;
+
+// Sum of the parts of all H, see _sum_parts()
+typedef struct Sum_Job
+{
+	Source *src;
+	int size;
+	Matrix *sum_h;
+	Matrix *n_sum_h;
+} Sum_Job;
+
+// Asynchronous iterations of all sources, see _async_worker(). Fields
+// from version on are shared by threads and guarded by pool_lock().
+typedef struct Async_Job
+{
+	Source_Job *sources;	// Products and updates of every source
+	Matrix *hh;	// Gram matrices H transpose(H) of all sources
+	Matrix *ww;	// Gram matrices transpose(W) W of all sources
+	Matrix *snap;	// Copies of both parts of the sum of H, two per source
+	Matrix *published;	// H of every source as it is in the sum
+	Matrix *sum_h;	// Sum of positive parts of published H
+	Matrix *n_sum_h;	// Sum of negative parts of published H
+	unsigned long version;	// Number of changes of the sum
+	unsigned long *seen;	// Version of the copies of every source
+	int *loops;	// Finished iterations of every source
+	double *costs;	// Latest cost of every source
+	bool *busy;	// Whether a thread iterates a source
+	bool *stopped;	// Whether a source converged
+	int running;	// Number of sources not converged
+	int least;	// Fewest iterations of sources not converged
+} Async_Job;
+
+Cost_Norm cost_norm = COST_FROBENIUS;
+Objective objective = OBJECTIVE_FULL;
+Solver_Mode solver_mode = SOLVER_SEQUENTIAL;
+int solver_staleness = 2;
+
+void _sum_parts(Source*, int, Matrix*, Matrix*);
 void _initialize(Source*, int);
-double** _pos_matrix(double**, int, int);
-double** _neg_matrix(double**, int, int);
-double _getCost(Source*, int, double);
+double _getCost(Source*, int, double, Matrix*, Matrix*, Matrix*);
+double _traceCost(const Source*, int, double, const Matrix*, const Matrix*,
+	const Matrix*, const Matrix*, const Matrix*, double);
+int _max_users(const Source*, int);
+bool _masked(const Source*);
+bool _spectral(const Source*, int);
+void _source_order(const Source*, int, int*);
+void _run_sources(Task_Func, Source_Job*);
+void _source_products(void*, int, int);
+void _source_updates(void*, int, int);
+void _source_product(Source_Job*, int);
+void _source_update(Source_Job*, int, const Matrix*, const Matrix*);
+void _update_rows(void*, int, int);
+void _update_cols(void*, int, int);
+void _sum_cols(void*, int, int);
+void _async_solve(Source_Job*, Matrix*, Matrix*, Matrix*, Matrix*, Arena*);
+void _async_worker(void*, int, int);
+int _async_pick(const Async_Job*);
+bool _async_step(Async_Job*, int);
+void _async_publish(Async_Job*, int);
+
+/*
+	Function: factorization_space
+	------------------------------
+	Size of the workspace of matrix_factorization(). It holds the
+	product W H transpose(H) shared by sources, the two parts of the sum
+	of all H, the products V transpose(H) and transpose(W) V, the Gram
+	matrices and the products transpose(W) W H of all sources.
+	Spectral costs add a groups-items difference, a users-items
+	residual, and start vectors of spectral2() for every source and
+	every pair of sources. Masked sources add their predictions in the
+	orders of rows and of columns. Sources updated in parallel take
+	W H transpose(H) of all users instead of those of one source.
+	Asynchronous runs add two copies of the sum of all H and the
+	published H of every source.
+
+	Parameters:
+	src - sources with their group number set
+	size - number of sources
+
+	Returns:
+	number of doubles
+ */
+size_t factorization_space(const Source *src, int size)
+{
+	size_t n = (size_t)_max_users(src, size);
+	size_t c = (size_t)src->C;
+	size_t k = (size_t)src->K;
+	size_t users = 0;
+	size_t result;
+
+	for (int i = 0; i < size; ++i) {
+		users += (size_t)src[i].N;
+	}
+	result = n * c + users * c + 2 * c * k +
+		(size_t)size * (2 * c * c + 2 * c * k);
+	for (int i = 0; i < size; ++i) {
+		if (_masked(&src[i])) {
+			result += 2 * src[i].R.nnz;
+		}
+	}
+	if (solver_mode != SOLVER_SEQUENTIAL) {
+		result += (users - n) * c;
+	}
+	if (solver_mode == SOLVER_ASYNC) {
+		result += (size_t)size * 3 * c * k;
+	}
+	if (_spectral(src, size)) {
+		result += c * k + n * k +
+			((size_t)size + (size_t)size * (size - 1) / 2) * k;
+	}
+
+	return result;
+}
 
 /*
 	Function: matrix_factorization
 	-------------------------------
-	NMF algorithm.
+	NMF algorithm. Ratings V are stored in float for runs with
+	PRECISION_MIXED, which halves the memory traffic of the products
+	with V. Products still sum in double on every path, so the kernel
+	chosen for a shape does not change results. Quantized ratings keep
+	their codes in every precision. W and H stay double. Sparse ratings
+	stay double as well, their products take O(nnz C) operations, see
+	sparse.h.
+	Updates split the products into positive and negative parts in
+	registers, see update_w and update_h of simd.h, so every product is
+	read once per update.
+	All intermediate matrices are taken from the workspace once, and
+	kernels keep their buffers between calls, see pool_scratch(), so
+	iterations do not allocate.
+	Every iteration first takes the products of all sources, then the
+	cost of the current W and H, and updates them only when the cost
+	still changes. Frobenius costs are taken from the products, see
+	_traceCost().
+	Masked objectives fit the rated entries of sparse sources only: the
+	products V transpose(H) and transpose(W) V skip unrated entries,
+	and W H is only predicted at rated entries, see sparse_predict(),
+	whose products with H and W replace W H transpose(H) and
+	transpose(W) W H. Iterations of these sources cost O(nnz C), and
+	their costs are Frobenius over rated entries.
+	Sources are coupled through the sum of all H only, which is taken
+	before any of them changes, so SOLVER_SOURCES runs the products and
+	updates of every source as one task of a parallel loop, see
+	_run_sources(). Products inside a task then run on its thread.
+	Updates of a source run in parallel over blocks of rows of W and of
+	columns of H, see _update_rows() and _update_cols(), so that runs
+	of one large source use all threads as well.
+	SOLVER_ASYNC drops the barrier at the end of every iteration, see
+	_async_solve(): every source iterates on its own against the latest
+	published sum of all H, at most solver_staleness iterations ahead of
+	the slowest source.
 
 	Parameters:
 	src - source contents
 	size - number of sources
-	valC - group number
+	alpha - weight of differences between H matrices
+	work - workspace of factorization_space() doubles
  */
-void matrix_factorization(Source *src, int size, double alpha)
+void matrix_factorization(Source *src, int size, double alpha, Arena *work)
 {
 	int loop = 0;
 	// Function cost
 	double old_cost = 0;
 	double cost;
-	// Matrices componnents
-	double **vh;
-	double **n_vh;
-	double **whh;
-	double **n_whh;
-	double **wwh;
-	double **n_wwh;
-	double **wv;
-	double **n_wv;
-	double **w;
-	double **h;
-	double **n_h;
-	double **sum_h;
-	double **n_sum_h;
-	double **trans;
-
-	double **temp = NULL;	// Pointer used to free memory
-
-	_initialize(src, size);
+	// Positive and negative parts of the sum of all H
+	Matrix sum_h;
+	Matrix n_sum_h;
 
-	cost = _getCost(src, size, alpha);
+	int maxN = _max_users(src, size);	// Rows of W parts
+	Matrix prodW;	// Intermediate product of users and groups
+	Matrix diff;	// Difference of H matrices of spectral costs
+	Matrix residual;	// V - WH of spectral costs
+	Matrix warm;	// Singular vectors of spectral costs, see _getCost()
+	int users = 0;	// Rows of prodW taken by sources so far
+	// Batches of all sources: H and W matrices, their Gram matrices
+	// H transpose(H) and transpose(W) W, products transpose(W) W H,
+	// V transpose(H) and transpose(W) V, and rows of prodW
+	Matrix *batch;
+	Matrix *hs;
+	Matrix *ws;
+	Matrix *hh;
+	Matrix *ww;
+	Matrix *wwhs;
+	Matrix *vhs;
+	Matrix *wvs;
+	Matrix *temps;
+	// Batches of sources fitted fully, sharing buffers of the above
+	int full = 0;
+	Matrix *full_ws;
+	Matrix *full_ww;
+	Matrix *full_hs;
+	Matrix *full_wwhs;
+	// Rated entries of masked sources with fill 0, and their predictions
+	Sparse *rated;
+	Sparse *pred;
+	double fit;	// Squared residuals of masked sources
+	double *fits;	// The same of every source
+	int *order;	// Sources by decreasing work
+	Source_Job job;
+	bool spectral = _spectral(src, size);
 
-	while ((fabs(old_cost - cost) > 1.0e-8) && (loop < MAX_LOOP)) {
-		++loop;
-		printf("\rIterations %d / %d", loop, MAX_LOOP);
-		old_cost = cost;
+	_initialize(src, size);
+	multiply_paths_reset();
+	for (int i = 0; i < size; ++i) {
+		if (src[i].sparse) {
+			// Rescaled ratings do not change during the run
+			src[i].normV = sparse_frobenius2(&src[i].R);
+			continue;
+		}
+		if (src[i].V.type <= MATRIX_F32) {
+			matrix_convert(&src[i].V,
+				(precision == PRECISION_DOUBLE) ? MATRIX_F64 : MATRIX_F32);
+		}
+		src[i].normV = frobenius2(&src[i].V);
+	}
 
-		sum_h = _sumH(src, size);
-		n_sum_h = _n_sumH(src, size);
-		// Loop until converge
+	batch = (Matrix*)malloc(12 * size * sizeof(Matrix));
+	rated = (Sparse*)malloc(2 * size * sizeof(Sparse));
+	fits = (double*)malloc(size * sizeof(double));
+	order = (int*)malloc(size * sizeof(int));
+	if ((batch == NULL) || (rated == NULL) || (fits == NULL) ||
+		(order == NULL)) {
+		fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
+		getchar();
+		exit(1);
+	}
+	hs = batch;
+	ws = batch + size;
+	hh = batch + 2 * size;
+	ww = batch + 3 * size;
+	wwhs = batch + 4 * size;
+	vhs = batch + 5 * size;
+	wvs = batch + 6 * size;
+	full_ws = batch + 7 * size;
+	full_ww = batch + 8 * size;
+	full_hs = batch + 9 * size;
+	full_wwhs = batch + 10 * size;
+	temps = batch + 11 * size;
+	pred = rated + size;
+	// Descriptors share buffers of the sources, which are updated in place
+	for (int i = 0; i < size; ++i) {
+		hs[i] = src[i].H;
+		ws[i] = src[i].W;
+	}
+	arena_reset(work);
+	if (solver_mode != SOLVER_SEQUENTIAL) {
 		for (int i = 0; i < size; ++i) {
-			// Computes components for W matrix update
-			trans = transpose(src[i].H, src[i].C, src[i].K);
-
-			vh = multiply(
-				src[i].V, src[i].N, trans, src[i].C, src[i].K);
-			temp = vh;
-			n_vh = _neg_matrix(vh, src[i].N, src[i].C);
-			vh = _pos_matrix(vh, src[i].N, src[i].C);
-			clear2D(&temp, src[i].N);
-
-			temp = multiply(
-				src[i].H, src[i].C, trans, src[i].C, src[i].K);
-			whh = multiply(
-				src[i].W, src[i].N, temp, src[i].C, src[i].C);
-			clear2D(&temp, src[i].C);
-			temp = whh;
-			n_whh = _neg_matrix(whh, src[i].N, src[i].C);
-			whh = _pos_matrix(whh, src[i].N, src[i].C);
-			clear2D(&temp, src[i].N);
-			clear2D(&trans, src[i].K);
-
-			w = _getW(src[i].W, src[i].N, src[i].C);
-
-			for (int j = 0; j < src->N; ++j) {
-				for (int k = 0; k < src->C; ++k) {
-					src[i].W[j][k] = src[i].W[j][k] * sqrt(
-						(vh[j][k] + n_whh[j][k]) /
-						(n_vh[j][k] + whh[j][k]));
-				}
+			users += src[i].N;
+		}
+		prodW = arena_matrix(work, users, src->C);
+		users = 0;
+	}
+	else {
+		prodW = arena_matrix(work, maxN, src->C);
+	}
+	sum_h = arena_matrix(work, src->C, src->K);
+	n_sum_h = arena_matrix(work, src->C, src->K);
+	for (int i = 0; i < size; ++i) {
+		hh[i] = arena_matrix(work, src->C, src->C);
+		ww[i] = arena_matrix(work, src->C, src->C);
+		wwhs[i] = arena_matrix(work, src->C, src->K);
+		vhs[i] = arena_matrix(work, src[i].N, src->C);
+		wvs[i] = arena_matrix(work, src->C, src->K);
+		// Sources updated in parallel write to their own rows
+		temps[i] = matrix_view(&prodW, users, 0, src[i].N, src->C);
+		if (solver_mode != SOLVER_SEQUENTIAL) {
+			users += src[i].N;
+		}
+		fits[i] = 0;
+		if (_masked(&src[i])) {
+			rated[i] = sparse_pattern(&src[i].R, src[i].R.value,
+				src[i].R.col_value);
+			pred[i] = sparse_pattern(&src[i].R,
+				arena_take(work, src[i].R.nnz),
+				arena_take(work, src[i].R.nnz));
+		}
+		else {
+			full_ws[full] = ws[i];
+			full_ww[full] = ww[i];
+			full_hs[full] = hs[i];
+			full_wwhs[full] = wwhs[i];
+			++full;
+		}
+	}
+	diff = matrix_wrap(NULL, 0, 0);
+	residual = matrix_wrap(NULL, 0, 0);
+	warm = matrix_wrap(NULL, 0, 0);
+	if (spectral) {
+		diff = arena_matrix(work, src->C, src->K);
+		residual = arena_matrix(work, maxN, src->K);
+		warm = arena_matrix(work, size + size * (size - 1) / 2, src->K);
+		// Zero vectors start spectral2() from scratch
+		for (int i = 0; i < warm.rows; ++i) {
+			for (int k = 0; k < warm.cols; ++k) {
+				MATRIX_AT(warm, i, k) = 0;
 			}
+		}
+	}
+	_source_order(src, size, order);
+	job.src = src;
+	job.alpha = alpha;
+	job.size = size;
+	job.order = order;
+	job.temps = temps;
+	job.hh = hh;
+	job.wwhs = wwhs;
+	job.vhs = vhs;
+	job.wvs = wvs;
+	job.rated = rated;
+	job.pred = pred;
+	job.fits = fits;
+	job.sum_h = &sum_h;
+	job.n_sum_h = &n_sum_h;
+	job.group = group_kernels(src->C);
 
-			clear2D(&vh, src[i].N);
-			clear2D(&n_vh, src[i].N);
-			clear2D(&whh, src[i].N);
-			clear2D(&n_whh, src[i].N);
-
-			// Computes components for H matrix update
-			trans = transpose(w, src[i].N, src[i].C);
-
-			wv = multiply(
-				trans, src[i].C, src[i].V, src[i].K, src[i].N);
-			temp = wv;
-			n_wv = _neg_matrix(wv, src[i].C, src[i].K);
-			wv = _pos_matrix(wv, src[i].C, src[i].K);
-			clear2D(&temp, src[i].C);
-
-			temp = multiply(trans, src[i].C, w, src[i].C, src[i].N);
-			clear2D(&trans, src[i].C);
-			wwh = multiply(
-				temp, src[i].C, src[i].H, src[i].K, src[i].C);
-			clear2D(&temp, src[i].C);
-			temp = wwh;
-			n_wwh = _neg_matrix(wwh, src[i].C, src[i].K);
-			wwh = _pos_matrix(wwh, src[i].C, src[i].K);
-			clear2D(&temp, src[i].C);
-
-			h = _pos_matrix(src[i].H, src[i].C, src[i].K);
-			n_h = _neg_matrix(src[i].H, src[i].C, src[i].K);
-
-			for (int j = 0; j < src[i].C; ++j) {
-				for (int k = 0; k < src[i].K; ++k) {
-					src[i].H[j][k] = src[i].H[j][k] * sqrt(
-						(wv[j][k] + n_wwh[j][k] +
-						alpha * size * n_h[j][k] +
-						alpha * (sum_h[j][k] - h[j][k])) /
-						(n_wv[j][k] + wwh[j][k] +
-						alpha * size * h[j][k] +
-						alpha * (n_sum_h[j][k] - n_h[j][k])));
-				}
+	if (solver_mode == SOLVER_ASYNC) {
+		_async_solve(&job, hh, ww, &sum_h, &n_sum_h, work);
+	}
+	else {
+		for (;;) {
+			// Updates of a source only read its own W and H, which are still
+			// unchanged here, so Gram products of all sources run as batches
+			gram_batch(false, size, hs, hh);
+			gram_batch(true, full, full_ws, full_ww);
+			_run_sources(_source_products, &job);
+			// Summed in the order of sources, whatever thread took them
+			fit = 0;
+			for (int i = 0; i < size; ++i) {
+				fit += fits[i];
 			}
+			_sum_parts(src, size, &sum_h, &n_sum_h);
 
-			clear2D(&w, src[i].N);
-			clear2D(&wv, src[i].C);
-			clear2D(&n_wv, src[i].C);
-			clear2D(&wwh, src[i].C);
-			clear2D(&n_wwh, src[i].C);
-			clear2D(&h, src[i].C);
-			clear2D(&n_h, src[i].C);
-		}
-		clear2D(&sum_h, src->C);
-		clear2D(&n_sum_h, src->C);
+			cost = spectral ?
+				_getCost(src, size, alpha, &diff, &residual, &warm) :
+				_traceCost(src, size, alpha, vhs, ww, hh, &sum_h, &n_sum_h,
+				fit);
+			if (!((fabs(old_cost - cost) > 1.0e-8) && (loop < MAX_LOOP))) {
+				break;
+			}
+			++loop;
+			printf("\rIterations %d / %d", loop, MAX_LOOP);
+			old_cost = cost;
 
-		cost = _getCost(src, size, alpha);
+			multiply_batch(false, false, full, full_ww, full_hs, full_wwhs);
+			// Loop until converge
+			_run_sources(_source_updates, &job);
+		}
 	}
+	free(batch);
+	free(rated);
+	free(fits);
+	free(order);
+	arena_reset(work);
 	printf("\nDone.\n");
+	multiply_paths_print();
 }
 
 /*
 	Function: _getCost
 	--------------------
 	Internal function. Calculate total cost with current
-	matrices W and H.
+	matrices W and H, measured by squared spectral norms. Every norm
+	starts from its singular vector of the previous iteration, which
+	changes little between iterations, see spectral2().
 
 	Parameters:
 	src - source structure
 	size - number of sources
+	alpha - weight of differences between H matrices
+	diff - groups-items workspace
+	residual - users-items workspace of the most users
+	warm - singular vectors of residuals of all sources, followed by
+		those of differences of all pairs of sources
 
 	Returns:
 	Cost value
  */
-double _getCost(Source *src, int size, double alpha)
+double _getCost(Source *src, int size, double alpha, Matrix *diff,
+	Matrix *residual, Matrix *warm)
 {
 	double result = 0;
 	double tempH = 0;
-	double **wh;
-	double **temp;
+	int pair = size;	// Row of warm of the next pair
+	Matrix wh;
 
-	// Calculate squared norms of all (Hs - Ht)
+	// Calculate squared norms of all (Hs - Ht), which are 0 for s = t
 	for (int i = 0; i < size; ++i) {
-		for (int j = i; j < size; ++j) {
-
-			temp = sub(src[i].H, src[j].H, src[i].C, src[i].K);
-			tempH += norm2(temp, src[i].C, src[i].K);
-			clear2D(&temp, src[i].C);
+		for (int j = i + 1; j < size; ++j) {
+			matrix_sub(diff, &src[i].H, &src[j].H);
+			tempH += spectral2(diff, MATRIX_ROW(*warm, pair));
+			++pair;
 		}
 	}
 	tempH = tempH * alpha * 2;
 	for (int i = 0; i < size; ++i) {
-		wh = multiply(
-			src[i].W, src[i].N, src[i].H, src[i].K, src[i].C);
-		temp = sub(src[i].V, wh, src[i].N, src[i].K);
-		clear2D(&wh, src[i].N);
-		result += norm2(temp, src[i].N, src[i].K);
-		clear2D(&temp, src[i].N);
+		// Residual V - WH overwrites the product
+		wh = matrix_view(residual, 0, 0, src[i].N, src[i].K);
+		matrix_multiply(&wh, false, false, &src[i].W, &src[i].H);
+		if (src[i].sparse) {
+			sparse_sub(&wh, &src[i].R, &wh);
+		}
+		else {
+			matrix_sub(&wh, &src[i].V, &wh);
+		}
+		result += spectral2(&wh, MATRIX_ROW(*warm, i));
 	}
 	result += tempH;
 
@@ -191,70 +460,85 @@ double _getCost(Source *src, int size, double alpha)
 }
 
 /*
-	Function: _getW
-	----------------
-	Internal function. Get matrix snapshot on matrix W.
+	Function: _traceCost
+	---------------------
+	Internal function. Calculates total cost with current matrices W and
+	H, measured by squared Frobenius norms. Residuals are never built:
+	the identity
+		|V - WH|^2 = |V|^2 - 2 tr(transpose(W) V transpose(H))
+			+ tr(transpose(W) W H transpose(H))
+	takes them from products of the iteration, so the cost is
+	O((N + K) C) once they are known. Differences of all pairs of H
+	matrices follow from
+		sum of |Hs - Ht|^2 = S sum of |Hs|^2 - |sum of Hs|^2
+	where |Hs|^2 is the trace of Hs transpose(Hs), so the penalty takes
+	one pass over the sum of H instead of one per pair. Masked sources
+	bring their residuals over rated entries instead.
 
 	Parameters:
-	w - matrix W
-	r - row number
-	c - column number
+	src - source structure, with squared norms of V
+	size - number of sources
+	alpha - weight of differences between H matrices
+	vhs - products V transpose(H) of all sources
+	ww - Gram matrices transpose(W) W of all sources
+	hh - Gram matrices H transpose(H) of all sources
+	sum_h - sum of positive parts of H matrices
+	n_sum_h - sum of negative parts of H matrices
+	fit - squared residuals of masked sources over rated entries
 
 	Returns:
-	A copy of matrix W
+	Cost value
  */
-double** _getW(double **w, int r, int c)
+double _traceCost(const Source *src, int size, double alpha,
+	const Matrix *vhs, const Matrix *ww, const Matrix *hh,
+	const Matrix *sum_h, const Matrix *n_sum_h, double fit)
 {
-	double **copy = (double**)malloc(r * sizeof(double*));
-	if (copy == NULL) {
-		fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
-		getchar();
-		exit(1);
-	}
+	double result = 0;
+	double tempH = 0;
 
-	for (int i = 0; i < r; ++i) {
-		copy[i] = (double*)malloc(c * sizeof(double));
-		for (int j = 0; j < c; ++j) {
-			copy[i][j] = w[i][j];
+	// Squared norms of all Hs are traces of their Gram matrices
+	for (int i = 0; i < size; ++i) {
+		for (int r = 0; r < src->C; ++r) {
+			tempH += MATRIX_AT(hh[i], r, r);
 		}
 	}
+	tempH = size * tempH - (frobenius2(sum_h) + frobenius2(n_sum_h) +
+		2 * matrix_inner(sum_h, n_sum_h));
+	// Rounding may leave a tiny negative value for equal H matrices
+	if (tempH < 0) {
+		tempH = 0;
+	}
+	tempH = tempH * alpha * 2;
+	for (int i = 0; i < size; ++i) {
+		if (!_masked(&src[i])) {
+			result += src[i].normV - 2 * matrix_inner(&src[i].W, &vhs[i]) +
+				matrix_inner(&ww[i], &hh[i]);
+		}
+	}
+	result += fit + tempH;
 
-	return copy;
+	return result;
 }
 
 /*
-	Function: _sumH
-	----------------
-	Internal function. Sum up all item-group matrices.
-	NOTE: Each source has same items in it.
+	Function: _max_users
+	---------------------
+	Internal function. Finds the largest user number of all sources.
 
 	Parameters:
 	src - source structures array
 	size - size of source array
 
 	Returns:
-	Sum of H matrices from all sources
+	most users in a source
  */
-double** _sumH(Source *src, int size) {
-	double **result = (double**)malloc(src->C * sizeof(double*));
-	if (result == NULL) {
-		fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
-		getchar();
-		exit(1);
-	}
-
-	for (int i = 0; i < src->C; ++i) {
-		result[i] = (double*)malloc(src->K * sizeof(double));
-		for (int j = 0; j < src->K; ++j) {
-			result[i][j] = 0;
-		}
-	}
+int _max_users(const Source *src, int size)
+{
+	int result = 0;
 
 	for (int i = 0; i < size; ++i) {
-		for (int j = 0; j < src->C; ++j) {
-			for (int k = 0; k < src->K; ++k) {
-				result[j][k] += (src[i].H[j][k] > 0) ? src[i].H[j][k] : 0;
-			}
+		if (src[i].N > result) {
+			result = src[i].N;
 		}
 	}
 
@@ -262,139 +546,686 @@ double** _sumH(Source *src, int size) {
 }
 
 /*
-	Function: _n_sumH
-	----------------
-	Internal function. Sum up all item-group matrices.
-	NOTE: Each source has same items in it.
+	Function: _masked
+	------------------
+	Internal function. Tells whether a source fits its rated entries
+	only, which needs sparse storage to know them.
+
+	Parameters:
+	s - source
+
+	Returns:
+	whether the source is masked
+ */
+bool _masked(const Source *s)
+{
+	return (objective == OBJECTIVE_MASKED) && s->sparse;
+}
+
+/*
+	Function: _spectral
+	--------------------
+	Internal function. Tells whether costs are spectral norms. Masked
+	sources have no residual matrix, so runs with one take Frobenius
+	costs, and so do asynchronous runs, whose sources measure their own
+	costs.
 
 	Parameters:
 	src - source structures array
 	size - size of source array
 
 	Returns:
-	Sum of H matrices from all sources
-*/
-double** _n_sumH(Source *src, int size) {
-	double **result = (double**)malloc(src->C * sizeof(double*));
-	if (result == NULL) {
-		fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
-		getchar();
-		exit(1);
+	whether costs are spectral
+ */
+bool _spectral(const Source *src, int size)
+{
+	if ((cost_norm != COST_SPECTRAL) || (solver_mode == SOLVER_ASYNC)) {
+		return false;
 	}
-
-	for (int i = 0; i < src->C; ++i) {
-		result[i] = (double*)malloc(src->K * sizeof(double));
-		for (int j = 0; j < src->K; ++j) {
-			result[i][j] = 0;
+	for (int i = 0; i < size; ++i) {
+		if (_masked(&src[i])) {
+			return false;
 		}
 	}
 
+	return true;
+}
+
+/*
+	Function: _source_order
+	------------------------
+	Internal function. Orders sources by decreasing work, the number of
+	stored ratings of sparse sources and N K of dense ones. Threads take
+	sources in this order, so the largest ones start first and small
+	ones fill the gaps at the end of an iteration.
+
+	Parameters:
+	src - source structures array
+	size - size of source array
+	order - receives source numbers
+ */
+void _source_order(const Source *src, int size, int *order)
+{
 	for (int i = 0; i < size; ++i) {
-		for (int j = 0; j < src->C; ++j) {
-			for (int k = 0; k < src->K; ++k) {
-				result[j][k] += (src[i].H[j][k] < 0) ? src[i].H[j][k] : 0;
+		double work = src[i].sparse ? (double)src[i].R.nnz :
+			(double)src[i].N * src[i].K;
+		int j = i;
+
+		// Insertion keeps sources of equal work in their order
+		for (; j > 0; --j) {
+			const Source *s = &src[order[j - 1]];
+			double other = s->sparse ? (double)s->R.nnz :
+				(double)s->N * s->K;
+
+			if (other >= work) {
+				break;
 			}
+			order[j] = order[j - 1];
 		}
+		order[j] = i;
 	}
+}
 
-	return result;
+/*
+	Function: _run_sources
+	-----------------------
+	Internal function. Runs a task for every source, as a parallel loop
+	over sources in SOLVER_SOURCES runs and on the calling thread
+	otherwise, where products inside tasks run in parallel instead.
+
+	Parameters:
+	func - task of sources, see _source_products() and _source_updates()
+	job - iteration state
+ */
+void _run_sources(Task_Func func, Source_Job *job)
+{
+	if (solver_mode == SOLVER_SOURCES) {
+		parallel_for(job->size, func, job);
+	}
+	else {
+		func(job, 0, job->size);
+	}
 }
 
 /*
-	FUnction: _initialize
-	---------------------
-	Internal function.
-	Initializes joint matrix values. Also rescales data range.
+	Function: _source_products
+	---------------------------
+	Internal function. Loop body of sources from begin to end - 1 in
+	the order of the job, calculates V transpose(H) and transpose(W) V,
+	and the predictions of masked sources with their residuals.
 
 	Parameters:
-	src - source structure
-	size - number of sources
+	arg - iteration state
+	begin - first source
+	end - source after the last one
  */
-void _initialize(Source *src, int size)
+void _source_products(void *arg, int begin, int end)
 {
-	double iniValue = 1.0 / (double) src->C;
+	Source_Job *job = (Source_Job*)arg;
 
-	for (int n = 0; n < size; ++n) {
-		for (int i = 0; i < src[n].N; ++i) {
-			for (int j = 0; j < src[n].K; ++j) {
-				double tempV = src[n].V[i][j];
-				if (j < src[n].C) {
-					// User group matrix
-					src[n].W[i][j] = iniValue;
-				}
-				if (i < src[n].C) {
-					// Item matrix
-					src[n].H[i][j] = 1.0 / 2.0;
-				}
-				if (!tempV) {
-					src[n].V[i][j] = (tempV - src[n].min) /
-						(src[n].max - src[n].min);
-				}
-			}
-		}
+	for (int t = begin; t < end; ++t) {
+		_source_product(job, job->order[t]);
 	}
 }
 
 /*
-	Function: _pos_matrix
-	---------------------
-	Internal function. First part of matrix factorized from 
-	original matrix.
+	Function: _source_product
+	--------------------------
+	Internal function. Calculates V transpose(H) and transpose(W) V of a
+	source, and the predictions of a masked source with its residual.
 
 	Parameters:
-	matrix - original matrix
-	row - row number of matix
-	col - column number of matrix
+	job - iteration state
+	i - source number
+ */
+void _source_product(Source_Job *job, int i)
+{
+	Source *s = &job->src[i];
 
-	Returns:
-	factorized matrix
+	if (_masked(s)) {
+		sparse_multiply_nt(&job->vhs[i], &job->rated[i], &s->H);
+		sparse_multiply_tn(&job->wvs[i], &s->W, &job->rated[i]);
+		job->fits[i] = sparse_predict(&job->pred[i], &s->R, &s->W, &s->H);
+	}
+	else if (s->sparse) {
+		sparse_multiply_nt(&job->vhs[i], &s->R, &s->H);
+		sparse_multiply_tn(&job->wvs[i], &s->W, &s->R);
+	}
+	else {
+		matrix_multiply(&job->vhs[i], false, true, &s->V, &s->H);
+		matrix_multiply(&job->wvs[i], true, false, &s->W, &s->V);
+	}
+}
+
+/*
+	Function: _source_updates
+	--------------------------
+	Internal function. Loop body of sources from begin to end - 1 in
+	the order of the job, updates W and H of every source. Each update
+	only reads products of its own source and the sum of all H, which
+	stays the same during the loop.
+
+	Parameters:
+	arg - iteration state
+	begin - first source
+	end - source after the last one
+ */
+void _source_updates(void *arg, int begin, int end)
+{
+	Source_Job *job = (Source_Job*)arg;
+
+	for (int t = begin; t < end; ++t) {
+		_source_update(job, job->order[t], job->sum_h, job->n_sum_h);
+	}
+}
+
+/*
+	Function: _source_update
+	-------------------------
+	Internal function. Updates W and H of a source from its products and
+	a sum of all H.
+
+	Parameters:
+	job - iteration state
+	i - source number
+	sum_h - sum of positive parts of H matrices
+	n_sum_h - sum of negative parts of H matrices
  */
-double** _pos_matrix(double **matrix, int row, int col) {
-	double **temp = (double**)malloc(sizeof(double*)* row);
-	if (temp == NULL) {
+void _source_update(Source_Job *job, int i, const Matrix *sum_h,
+	const Matrix *n_sum_h)
+{
+	Source *s = &job->src[i];
+	Matrix *temp = &job->temps[i];
+	Update_Job update;
+
+	if (_masked(s)) {
+		// Predictions were taken from W and H before they change
+		sparse_multiply_nt(temp, &job->pred[i], &s->H);
+		sparse_multiply_tn(&job->wwhs[i], &s->W, &job->pred[i]);
+	}
+	else {
+		matrix_multiply(temp, false, false, &s->W, &job->hh[i]);
+	}
+
+	update.s = s;
+	update.vh = &job->vhs[i];
+	update.whh = temp;
+	update.wv = &job->wvs[i];
+	update.wwh = &job->wwhs[i];
+	update.sum_h = sum_h;
+	update.n_sum_h = n_sum_h;
+	update.alpha = job->alpha;
+	update.weight = job->alpha * job->size;
+	update.group = job->group;
+	// Loops started from a task of the sources run on its thread
+	parallel_for((s->N + UPDATE_ROWS - 1) / UPDATE_ROWS, _update_rows,
+		&update);
+	// transpose(W) V was taken before W changed
+	parallel_for((s->K + UPDATE_COLS - 1) / UPDATE_COLS, _update_cols,
+		&update);
+}
+
+/*
+	Function: _async_solve
+	-----------------------
+	Internal function. Asynchronous NMF. Every thread of the pool takes
+	one source at a time, runs one iteration of it and takes the next,
+	see _async_worker(). Sources are not synchronized after iterations:
+	each one publishes its H into the sum of all H when it is updated,
+	see _async_publish(), and the next iteration of any source starts
+	from the sum as it is then. A source at iteration t may only start
+	once every other source finished iteration t - solver_staleness, or
+	converged, which bounds the age of the sums it reads. The slowest
+	source can always start, so threads never wait for sources that are
+	not taken. Large sources keep their threads while small ones iterate
+	ahead on the others, instead of waiting at a barrier.
+	Sources stop when their own cost stops changing, see _async_step().
+	Results depend on the timing of threads.
+
+	Parameters:
+	sources - products and updates of all sources
+	hh - Gram matrices H transpose(H) of all sources
+	ww - Gram matrices transpose(W) W of all sources
+	sum_h - sum of positive parts of H matrices
+	n_sum_h - sum of negative parts of H matrices
+	work - workspace with room for the copies, see factorization_space()
+ */
+void _async_solve(Source_Job *sources, Matrix *hh, Matrix *ww,
+	Matrix *sum_h, Matrix *n_sum_h, Arena *work)
+{
+	int size = sources->size;
+	Source *src = sources->src;
+	Async_Job job;
+
+	job.snap = (Matrix*)malloc(3 * size * sizeof(Matrix));
+	job.seen = (unsigned long*)malloc(size * sizeof(unsigned long));
+	job.loops = (int*)malloc(size * sizeof(int));
+	job.costs = (double*)malloc(size * sizeof(double));
+	job.busy = (bool*)malloc(2 * size * sizeof(bool));
+	if ((job.snap == NULL) || (job.seen == NULL) || (job.loops == NULL) ||
+		(job.costs == NULL) || (job.busy == NULL)) {
 		fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
 		getchar();
 		exit(1);
 	}
+	job.sources = sources;
+	job.hh = hh;
+	job.ww = ww;
+	job.published = job.snap + 2 * size;
+	job.sum_h = sum_h;
+	job.n_sum_h = n_sum_h;
+	job.stopped = job.busy + size;
+	for (int i = 0; i < size; ++i) {
+		job.snap[2 * i] = arena_matrix(work, src->C, src->K);
+		job.snap[2 * i + 1] = arena_matrix(work, src->C, src->K);
+		job.published[i] = arena_matrix(work, src->C, src->K);
+		for (int j = 0; j < src->C; ++j) {
+			memcpy(MATRIX_ROW(job.published[i], j), MATRIX_ROW(src[i].H, j),
+				src->K * sizeof(double));
+		}
+		job.seen[i] = 0;
+		job.loops[i] = 0;
+		job.costs[i] = 0;
+		job.busy[i] = false;
+		job.stopped[i] = false;
+	}
+	_sum_parts(src, size, sum_h, n_sum_h);
+	job.version = 1;
+	job.running = size;
+	job.least = 0;
+
+	parallel_for(pool_threads(), _async_worker, &job);
+
+	free(job.snap);
+	free(job.seen);
+	free(job.loops);
+	free(job.costs);
+	free(job.busy);
+}
+
+/*
+	Function: _async_worker
+	------------------------
+	Internal function. Loop body of one thread of _async_solve(). Takes
+	sources that may start, see _async_pick(), and iterates them until
+	all sources converged.
+
+	Parameters:
+	arg - asynchronous run
+	begin - unused, every task works on all sources
+	end - unused
+ */
+void _async_worker(void *arg, int begin, int end)
+{
+	Async_Job *job = (Async_Job*)arg;
+
+	(void)begin;
+	(void)end;
+	for (;;) {
+		int i;
+		int least;
+		bool more;
+
+		pool_lock();
+		while (((i = _async_pick(job)) < 0) && (job->running > 0)) {
+			pool_wait();
+		}
+		if (i < 0) {
+			pool_unlock();
+			return;
+		}
+		job->busy[i] = true;
+		pool_unlock();
+
+		more = _async_step(job, i);
+
+		pool_lock();
+		job->busy[i] = false;
+		if (more) {
+			++job->loops[i];
+		}
+		else {
+			job->stopped[i] = true;
+			--job->running;
+		}
+		// Sources that were too far ahead may start now. Once every
+		// source stopped, the progress keeps its last value.
+		least = MAX_LOOP;
+		for (int s = 0; s < job->sources->size; ++s) {
+			if (!job->stopped[s] && (job->loops[s] < least)) {
+				least = job->loops[s];
+			}
+		}
+		if ((job->running > 0) && (least > job->least)) {
+			job->least = least;
+			printf("\rIterations %d / %d", least, MAX_LOOP);
+		}
+		pool_notify();
+		pool_unlock();
+	}
+}
+
+/*
+	Function: _async_pick
+	----------------------
+	Internal function. Chooses the next source of a thread, the one with
+	fewest iterations of those that are neither taken nor converged and
+	at most solver_staleness iterations ahead of the slowest source.
+	Ties go to the larger source. Called with pool_lock() held.
 
-	for (int i = 0; i < row; ++i) {
-		temp[i] = (double*)malloc(sizeof(double) * col);
-		for (int j = 0; j < col; ++j) {
-			temp[i][j] = (matrix[i][j] > 0) ? matrix[i][j] : 0;
+	Parameters:
+	job - asynchronous run
+
+	Returns:
+	source number, or -1 when no source may start
+ */
+int _async_pick(const Async_Job *job)
+{
+	const Source_Job *sources = job->sources;
+	int result = -1;
+
+	for (int t = 0; t < sources->size; ++t) {
+		int i = sources->order[t];
+
+		if (job->busy[i] || job->stopped[i] ||
+			(job->loops[i] > job->least + solver_staleness)) {
+			continue;
+		}
+		if ((result < 0) || (job->loops[i] < job->loops[result])) {
+			result = i;
 		}
 	}
 
-	return temp;
+	return result;
 }
 
 /*
-	Function: _neg_matrix
-	---------------------
-	Internal function. Second part of matrix factorized from 
-	original matrix.
+	Function: _async_step
+	----------------------
+	Internal function. Runs one iteration of a source against its copy
+	of the sum of all H, which is refreshed first when the sum changed.
+	The cost of the source is its reconstruction error plus the terms
+	of the penalty that depend on its H,
+		2 alpha ((S + 1) |Hs|^2 - 2 <Hs, sum of all H>)
+	which is the penalty of _traceCost() up to terms of other sources.
+	The source converges when this cost stops changing.
 
 	Parameters:
-	matrix - original matrix
-	row - row number of matrix
-	col - column number of matrix
+	job - asynchronous run
+	i - source number
 
 	Returns:
-	factorized matrix
+	whether the source was updated, false when it converged
  */
-double** _neg_matrix(double **matrix, int row, int col) {
-	double **temp = (double**)malloc(sizeof(double*)* row);
-	if (temp == NULL) {
-		fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
-		getchar();
-		exit(1);
+bool _async_step(Async_Job *job, int i)
+{
+	Source_Job *sources = job->sources;
+	Source *s = &sources->src[i];
+	Matrix *pos = &job->snap[2 * i];
+	Matrix *neg = &job->snap[2 * i + 1];
+	double trace = 0;
+	double cost;
+
+	pool_lock();
+	if (job->seen[i] != job->version) {
+		for (int j = 0; j < s->C; ++j) {
+			memcpy(MATRIX_ROW(*pos, j), MATRIX_ROW(*job->sum_h, j),
+				s->K * sizeof(double));
+			memcpy(MATRIX_ROW(*neg, j), MATRIX_ROW(*job->n_sum_h, j),
+				s->K * sizeof(double));
+		}
+		job->seen[i] = job->version;
 	}
+	pool_unlock();
 
-	for (int i = 0; i < row; ++i) {
-		temp[i] = (double*)malloc(sizeof(double)* col);
-		for (int j = 0; j < col; ++j) {
-			temp[i][j] = (matrix[i][j] > 0) ? 0 : matrix[i][j];
+	gram_batch(false, 1, &s->H, &job->hh[i]);
+	if (!_masked(s)) {
+		gram_batch(true, 1, &s->W, &job->ww[i]);
+	}
+	_source_product(sources, i);
+
+	for (int r = 0; r < s->C; ++r) {
+		trace += MATRIX_AT(job->hh[i], r, r);
+	}
+	cost = _masked(s) ? sources->fits[i] :
+		s->normV - 2 * matrix_inner(&s->W, &sources->vhs[i]) +
+		matrix_inner(&job->ww[i], &job->hh[i]);
+	cost += 2 * sources->alpha * ((sources->size + 1) * trace -
+		2 * (matrix_inner(&s->H, pos) + matrix_inner(&s->H, neg)));
+	if (!((fabs(job->costs[i] - cost) > 1.0e-8) &&
+		(job->loops[i] < MAX_LOOP))) {
+		return false;
+	}
+	job->costs[i] = cost;
+
+	if (!_masked(s)) {
+		matrix_multiply(&sources->wwhs[i], false, false, &job->ww[i], &s->H);
+	}
+	_source_update(sources, i, pos, neg);
+	_async_publish(job, i);
+
+	return true;
+}
+
+/*
+	Function: _async_publish
+	-------------------------
+	Internal function. Replaces the published H of a source in the sum
+	of all H by its current H, and counts the change. Only the parts of
+	this source are touched, so publishing costs O(C K) whatever the
+	number of sources.
+
+	Parameters:
+	job - asynchronous run
+	i - source number
+ */
+void _async_publish(Async_Job *job, int i)
+{
+	const Source *s = &job->sources->src[i];
+
+	pool_lock();
+	for (int j = 0; j < s->C; ++j) {
+		const double *rowH = MATRIX_ROW(s->H, j);
+		double *rowOld = MATRIX_ROW(job->published[i], j);
+		double *rowP = MATRIX_ROW(*job->sum_h, j);
+		double *rowN = MATRIX_ROW(*job->n_sum_h, j);
+
+		for (int k = 0; k < s->K; ++k) {
+			if (rowOld[k] > 0) {
+				rowP[k] -= rowOld[k];
+			}
+			else {
+				rowN[k] -= rowOld[k];
+			}
+			if (rowH[k] > 0) {
+				rowP[k] += rowH[k];
+			}
+			else {
+				rowN[k] += rowH[k];
+			}
+			rowOld[k] = rowH[k];
 		}
 	}
+	++job->version;
+	pool_unlock();
+}
 
-	return temp;
-}
\ No newline at end of file
+/*
+	Function: _update_rows
+	-----------------------
+	Internal function. Loop body of the update of W, updates blocks of
+	UPDATE_ROWS rows from begin to end - 1. Rows only read their own
+	rows of the products.
+
+	Parameters:
+	arg - update of a source
+	begin - first block
+	end - block after the last one
+ */
+void _update_rows(void *arg, int begin, int end)
+{
+	const Update_Job *job = (const Update_Job*)arg;
+	Source *s = job->s;
+	int last = end * UPDATE_ROWS;
+
+	if (last > s->N) {
+		last = s->N;
+	}
+	for (int j = begin * UPDATE_ROWS; j < last; ++j) {
+		if (job->group != NULL) {
+			job->group->update_w(MATRIX_ROW(s->W, j),
+				MATRIX_ROW(*job->vh, j), MATRIX_ROW(*job->whh, j));
+		}
+		else {
+			simd.update_w(MATRIX_ROW(s->W, j), MATRIX_ROW(*job->vh, j),
+				MATRIX_ROW(*job->whh, j), s->C);
+		}
+	}
+}
+
+/*
+	Function: _update_cols
+	-----------------------
+	Internal function. Loop body of the update of H, updates blocks of
+	UPDATE_COLS columns from begin to end - 1, in every row of H.
+
+	Parameters:
+	arg - update of a source
+	begin - first block
+	end - block after the last one
+ */
+void _update_cols(void *arg, int begin, int end)
+{
+	const Update_Job *job = (const Update_Job*)arg;
+	Source *s = job->s;
+	int first = begin * UPDATE_COLS;
+	int last = end * UPDATE_COLS;
+
+	if (last > s->K) {
+		last = s->K;
+	}
+	for (int j = 0; j < s->C; ++j) {
+		simd.update_h(&MATRIX_AT(s->H, j, first),
+			&MATRIX_AT(*job->wv, j, first), &MATRIX_AT(*job->wwh, j, first),
+			&MATRIX_AT(*job->sum_h, j, first),
+			&MATRIX_AT(*job->n_sum_h, j, first), job->alpha, job->weight,
+			last - first);
+	}
+}
+
+/*
+	Function: _sum_parts
+	---------------------
+	Internal function. Sums up positive and negative parts of all
+	item-group matrices in one pass, in parallel over blocks of
+	UPDATE_COLS columns.
+	NOTE: Each source has same items in it.
+
+	Parameters:
+	src - source structures array
+	size - size of source array
+	sum_h - sum of positive parts of H matrices
+	n_sum_h - sum of negative parts of H matrices
+ */
+void _sum_parts(Source *src, int size, Matrix *sum_h, Matrix *n_sum_h) {
+	Sum_Job job;
+
+	job.src = src;
+	job.size = size;
+	job.sum_h = sum_h;
+	job.n_sum_h = n_sum_h;
+	parallel_for((src->K + UPDATE_COLS - 1) / UPDATE_COLS, _sum_cols, &job);
+}
+
+/*
+	Function: _sum_cols
+	--------------------
+	Internal function. Loop body of _sum_parts(), sums up blocks of
+	UPDATE_COLS columns from begin to end - 1. Sources are added in
+	their order, whatever the blocks.
+
+	Parameters:
+	arg - sum job
+	begin - first block
+	end - block after the last one
+ */
+void _sum_cols(void *arg, int begin, int end)
+{
+	const Sum_Job *job = (const Sum_Job*)arg;
+	const Source *src = job->src;
+	int first = begin * UPDATE_COLS;
+	int last = end * UPDATE_COLS;
+
+	if (last > src->K) {
+		last = src->K;
+	}
+	for (int j = 0; j < src->C; ++j) {
+		double *rowP = MATRIX_ROW(*job->sum_h, j);
+		double *rowN = MATRIX_ROW(*job->n_sum_h, j);
+		for (int k = first; k < last; ++k) {
+			rowP[k] = 0;
+			rowN[k] = 0;
+		}
+	}
+	for (int i = 0; i < job->size; ++i) {
+		for (int j = 0; j < src->C; ++j) {
+			const double *rowH = MATRIX_ROW(src[i].H, j);
+			double *rowP = MATRIX_ROW(*job->sum_h, j);
+			double *rowN = MATRIX_ROW(*job->n_sum_h, j);
+			for (int k = first; k < last; ++k) {
+				if (rowH[k] > 0) {
+					rowP[k] += rowH[k];
+				}
+				else {
+					rowN[k] += rowH[k];
+				}
+			}
+		}
+	}
+}
+
+/*
+	FUnction: _initialize
+	---------------------
+	Internal function.
+	Initializes joint matrix values. Also rescales data range: unrated
+	entries become (0 - min) / (max - min), which sparse ratings keep as
+	their fill.
+
+	Parameters:
+	src - source structure
+	size - number of sources
+ */
+void _initialize(Source *src, int size)
+{
+	double iniValue = 1.0 / (double) src->C;
+
+	for (int n = 0; n < size; ++n) {
+		// User group matrix
+		for (int i = 0; i < src[n].N; ++i) {
+			for (int j = 0; (j < src[n].C) && (j < src[n].K); ++j) {
+				MATRIX_AT(src[n].W, i, j) = iniValue;
+			}
+		}
+		// Item matrix
+		for (int i = 0; (i < src[n].C) && (i < src[n].N); ++i) {
+			for (int j = 0; j < src[n].K; ++j) {
+				MATRIX_AT(src[n].H, i, j) = 1.0 / 2.0;
+			}
+		}
+
+		if (src[n].sparse) {
+			src[n].R.fill = (0 - src[n].min) / (src[n].max - src[n].min);
+			continue;
+		}
+		for (int i = 0; i < src[n].N; ++i) {
+			for (int j = 0; j < src[n].K; ++j) {
+				double tempV = MATRIX_GET(src[n].V, i, j);
+				if (!tempV) {
+					MATRIX_SET(src[n].V, i, j, (tempV - src[n].min) /
+						(src[n].max - src[n].min));
+				}
+			}
+		}
+	}
+}
@@ -2,13 +2,23 @@
 #include <stdlib.h>
 #include <string.h>
 #include <malloc.h>
+#include <math.h>
 
 #define _SEP " \t\n"
 
+int _read_ratings(FILE*, Source*, bool, bool*);
+
 /*
 	Function: file_to_matrix
 	-------------------------
-	Fill up matrix entries that read from a source file.
+	Fill up matrix entries that read from a source file. Quantized
+	ratings need their range before the first code is stored, so the
+	file is read twice for them. Code 0 stands for unrated entries after
+	the rescaling of matrix_factorization(). Integer ratings get one code
+	each, so they are stored exactly, see matrix_set_range(). Sparse
+	ratings are read twice as well: the first pass counts the ratings of
+	every user, so that the second one stores them straight into
+	compressed rows.
 	
 	Parameter:
 	file - source file
@@ -18,6 +28,50 @@
 	0 for success, 1 for failure.
  */
 int file_to_matrix(FILE *file, Source *src)
+{
+	if (src->sparse) {
+		if (_read_ratings(file, src, false, NULL)) {
+			return 1;
+		}
+		sparse_reserve(&src->R);
+		if (_read_ratings(file, src, true, NULL)) {
+			return 1;
+		}
+		sparse_finish(&src->R);
+		return 0;
+	}
+	if ((src->V.type == MATRIX_U8) || (src->V.type == MATRIX_U16)) {
+		bool integer = true;
+
+		if (_read_ratings(file, src, false, &integer)) {
+			return 1;
+		}
+		if (src->max > src->min) {
+			matrix_set_range(&src->V, -src->min / (src->max - src->min),
+				src->min, src->max, integer);
+		}
+	}
+
+	return _read_ratings(file, src, true, NULL);
+}
+
+/*
+	Function: _read_ratings
+	------------------------
+	Internal function. Reads ratings of a source file, and finds their
+	minimum and maximum. Sparse ratings are counted when they are not
+	stored.
+
+	Parameter:
+	file - source file
+	src - source structure
+	store - whether ratings are stored into V
+	integer - cleared when a rating is not an integer, may be NULL
+
+	Returns:
+	0 for success, 1 for failure.
+ */
+int _read_ratings(FILE *file, Source *src, bool store, bool *integer)
 {
 	// Set file pointer to the beginning
 	if (!fseek(file, 0, SEEK_SET)) {
@@ -47,7 +101,22 @@ int file_to_matrix(FILE *file, Source *src)
 								src->items, seg[0], 0, iLength - 1);
 							--nIndex;
 							if ((kIndex >= 0) && nIndex < src->N) {
-								src->V[nIndex][kIndex] = value;
+								if (src->sparse) {
+									if (store) {
+										sparse_insert(&src->R, nIndex, kIndex,
+											value);
+									}
+									else {
+										sparse_count(&src->R, nIndex);
+									}
+								}
+								else if (store) {
+									MATRIX_SET(src->V, nIndex, kIndex, value);
+								}
+								if ((integer != NULL) &&
+									(value != floor(value))) {
+									*integer = false;
+								}
 								if ((src->min == -1) || (src->min > value)) {
 									src->min = value;
 								}
@@ -61,6 +130,7 @@ int file_to_matrix(FILE *file, Source *src)
 			}
 		}
 
+		free(seg);
 		return 0;
 	}
 	else {
@@ -0,0 +1,1291 @@
+#include "simd.h"
+#include "simd_target.h"
+#include "gemm.h"
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef SIMD_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+void _scalar_gemm_kernel(int, const double*, const double*, double*,
+	size_t, int, int, double);
+void _scalar_add(const double*, const double*, double*, int);
+void _scalar_sub(const double*, const double*, double*, int);
+void _scalar_axpy(double*, double, const double*, int);
+void _scalar_split(const double*, double*, double*, int);
+void _scalar_sqdiff_acc(double*, const double*, const double*, int);
+void _scalar_update_w(double*, const double*, const double*, int);
+void _scalar_update_h(double*, const double*, const double*,
+	const double*, const double*, double, double, int);
+void _scalar_combine(double*, const double*, const double*, size_t, int,
+	int, double);
+void _scalar_gather(double*, const double*, const int*, const double*,
+	size_t, int, int, double);
+double _scalar_dot(const double*, const double*, int);
+void _scalar_lanes_syrk(const double*, int, int, double*);
+void _scalar_transpose(const double*, size_t, double*, size_t, int, int,
+	bool);
+void _scalar_widen(const float*, double*, int);
+void _scalar_narrow(const double*, float*, int);
+void _scalar_decode_u8(const unsigned char*, double, double, double, double*,
+	int);
+void _scalar_decode_u16(const unsigned short*, double, double, double,
+	double*, int);
+void _simd_merge(const double*, double*, size_t, int, int, double);
+
+// Scalar kernels are used until simd_initialize() is called
+Simd_Kernels simd = {
+	"scalar",
+	ISA_SCALAR,
+	_scalar_gemm_kernel,
+	_scalar_add,
+	_scalar_sub,
+	_scalar_axpy,
+	_scalar_split,
+	_scalar_sqdiff_acc,
+	_scalar_update_w,
+	_scalar_update_h,
+	_scalar_combine,
+	_scalar_gather,
+	_scalar_dot,
+	_scalar_lanes_syrk,
+	_scalar_transpose,
+	_scalar_widen,
+	_scalar_narrow,
+	_scalar_decode_u8,
+	_scalar_decode_u16
+};
+
+/*	Scalar kernels	*/
+
+/*
+	Function: _scalar_gemm_kernel
+	------------------------------
+	Internal function. Register tiled micro-kernel. Multiplies a packed
+	A micro-panel with a packed B micro-panel and merges the GEMM_MR x
+	GEMM_NR tile into C. Only the top-left mr x nr part is written.
+
+	Parameters:
+	kc - depth of the micro-panels
+	a - packed A micro-panel
+	b - packed B micro-panel
+	c - first entry of the C tile
+	ldc - leading dimension of C
+	mr - valid rows of the tile
+	nr - valid columns of the tile
+	beta - scaling of original C tile
+*/
+void _scalar_gemm_kernel(int kc, const double *a, const double *b,
+	double *c, size_t ldc, int mr, int nr, double beta)
+{
+	double ab[GEMM_MR * GEMM_NR] = { 0 };
+
+	for (int p = 0; p < kc; ++p) {
+		for (int i = 0; i < GEMM_MR; ++i) {
+			double aip = a[i];
+			for (int j = 0; j < GEMM_NR; ++j) {
+				ab[i * GEMM_NR + j] += aip * b[j];
+			}
+		}
+		a += GEMM_MR;
+		b += GEMM_NR;
+	}
+
+	_simd_merge(ab, c, ldc, mr, nr, beta);
+}
+
+/*
+	Scalar elementwise kernels. They define results of every vectorized
+	version, see simd.h.
+*/
+void _scalar_add(const double *a, const double *b, double *r, int n)
+{
+	for (int i = 0; i < n; ++i) {
+		r[i] = a[i] + b[i];
+	}
+}
+
+void _scalar_sub(const double *a, const double *b, double *r, int n)
+{
+	for (int i = 0; i < n; ++i) {
+		r[i] = a[i] - b[i];
+	}
+}
+
+void _scalar_axpy(double *y, double alpha, const double *x, int n)
+{
+	for (int i = 0; i < n; ++i) {
+		y[i] += alpha * x[i];
+	}
+}
+
+void _scalar_split(const double *a, double *pos, double *neg, int n)
+{
+	for (int i = 0; i < n; ++i) {
+		pos[i] = (a[i] > 0) ? a[i] : 0;
+		neg[i] = (a[i] > 0) ? 0 : a[i];
+	}
+}
+
+void _scalar_sqdiff_acc(double *acc, const double *a, const double *b,
+	int n)
+{
+	for (int i = 0; i < n; ++i) {
+		double d = a[i] - b[i];
+		acc[i] += d * d;
+	}
+}
+
+void _scalar_update_w(double *w, const double *vh, const double *whh,
+	int n)
+{
+	for (int i = 0; i < n; ++i) {
+		double num = ((vh[i] > 0) ? vh[i] : 0) + ((whh[i] > 0) ? 0 : whh[i]);
+		double den = ((vh[i] > 0) ? 0 : vh[i]) + ((whh[i] > 0) ? whh[i] : 0);
+		w[i] = w[i] * sqrt(num / den);
+	}
+}
+
+void _scalar_update_h(double *h, const double *wv, const double *wwh,
+	const double *sum_h, const double *n_sum_h, double alpha,
+	double weight, int n)
+{
+	for (int i = 0; i < n; ++i) {
+		double hp = (h[i] > 0) ? h[i] : 0;
+		double hn = (h[i] > 0) ? 0 : h[i];
+		double num = ((wv[i] > 0) ? wv[i] : 0) + ((wwh[i] > 0) ? 0 : wwh[i]);
+		double den = ((wv[i] > 0) ? 0 : wv[i]) + ((wwh[i] > 0) ? wwh[i] : 0);
+
+		h[i] = h[i] * sqrt(
+			(num + weight * hn + alpha * (sum_h[i] - hp)) /
+			(den + weight * hp + alpha * (n_sum_h[i] - hn)));
+	}
+}
+
+void _scalar_combine(double *c, const double *coef, const double *b,
+	size_t ldb, int k, int n, double beta)
+{
+	for (int j = 0; j < n; ++j) {
+		c[j] = (beta == 0) ? 0 : beta * c[j];
+	}
+	for (int p = 0; p < k; ++p) {
+		const double *rowB = b + p * ldb;
+		for (int j = 0; j < n; ++j) {
+			c[j] += coef[p] * rowB[j];
+		}
+	}
+}
+
+void _scalar_gather(double *c, const double *coef, const int *index,
+	const double *b, size_t ldb, int k, int n, double shift)
+{
+	for (int p = 0; p < k; ++p) {
+		const double *rowB = b + index[p] * ldb;
+		double x = coef[p] - shift;
+		for (int j = 0; j < n; ++j) {
+			c[j] += x * rowB[j];
+		}
+	}
+}
+
+void _scalar_decode_u8(const unsigned char *a, double scale, double bias,
+	double fill, double *r, int n)
+{
+	for (int i = 0; i < n; ++i) {
+		r[i] = (a[i] == 0) ? fill : bias + scale * a[i];
+	}
+}
+
+void _scalar_decode_u16(const unsigned short *a, double scale, double bias,
+	double fill, double *r, int n)
+{
+	for (int i = 0; i < n; ++i) {
+		r[i] = (a[i] == 0) ? fill : bias + scale * a[i];
+	}
+}
+
+double _scalar_dot(const double *a, const double *b, int n)
+{
+	double result = 0;
+
+	for (int i = 0; i < n; ++i) {
+		result += a[i] * b[i];
+	}
+
+	return result;
+}
+
+void _scalar_lanes_syrk(const double *a, int n, int kb, double *acc)
+{
+	for (int i = 0; i < n; ++i) {
+		for (int j = 0; j <= i; ++j) {
+			double *sum = acc + (i * (i + 1) / 2 + j) * SIMD_LANES;
+			for (int p = 0; p < kb; ++p) {
+				const double *x = a + (p * n + i) * SIMD_LANES;
+				const double *y = a + (p * n + j) * SIMD_LANES;
+				for (int l = 0; l < SIMD_LANES; ++l) {
+					sum[l] += x[l] * y[l];
+				}
+			}
+		}
+	}
+}
+
+void _scalar_transpose(const double *a, size_t lda, double *r, size_t ldr,
+	int rows, int cols, bool stream)
+{
+	// Plain C has no non-temporal stores, R is always written cached
+	(void)stream;
+	for (int j = 0; j < cols; ++j) {
+		double *rowR = r + j * ldr;
+		for (int i = 0; i < rows; ++i) {
+			rowR[i] = a[i * lda + j];
+		}
+	}
+}
+
+void _scalar_widen(const float *a, double *r, int n)
+{
+	for (int i = 0; i < n; ++i) {
+		r[i] = a[i];
+	}
+}
+
+void _scalar_narrow(const double *a, float *r, int n)
+{
+	for (int i = 0; i < n; ++i) {
+		r[i] = (float)a[i];
+	}
+}
+
+/*
+	Function: _simd_merge
+	----------------------
+	Internal function. Merges a computed tile into C, C = tile + beta * C.
+
+	Parameters:
+	ab - computed GEMM_MR x GEMM_NR tile
+	c - first entry of the C tile
+	ldc - leading dimension of C
+	mr - valid rows of the tile
+	nr - valid columns of the tile
+	beta - scaling of original C tile
+*/
+void _simd_merge(const double *ab, double *c, size_t ldc, int mr, int nr,
+	double beta)
+{
+	if (beta == 0) {
+		for (int i = 0; i < mr; ++i) {
+			for (int j = 0; j < nr; ++j) {
+				c[i * ldc + j] = ab[i * GEMM_NR + j];
+			}
+		}
+	}
+	else {
+		for (int i = 0; i < mr; ++i) {
+			for (int j = 0; j < nr; ++j) {
+				c[i * ldc + j] = beta * c[i * ldc + j] + ab[i * GEMM_NR + j];
+			}
+		}
+	}
+}
+
+#ifdef SIMD_X86
+
+/*	AVX2 kernels	*/
+
+/*
+	Function: _avx2_gemm_kernel
+	----------------------------
+	Internal function. AVX2 version of the micro-kernel. Each tile row
+	is kept in two 256-bit registers.
+*/
+SIMD_AVX2 void _avx2_gemm_kernel(int kc, const double *a, const double *b,
+	double *c, size_t ldc, int mr, int nr, double beta)
+{
+	__m256d c00 = _mm256_setzero_pd();
+	__m256d c01 = _mm256_setzero_pd();
+	__m256d c10 = _mm256_setzero_pd();
+	__m256d c11 = _mm256_setzero_pd();
+	__m256d c20 = _mm256_setzero_pd();
+	__m256d c21 = _mm256_setzero_pd();
+	__m256d c30 = _mm256_setzero_pd();
+	__m256d c31 = _mm256_setzero_pd();
+
+	for (int p = 0; p < kc; ++p) {
+		__m256d b0 = _mm256_loadu_pd(b);
+		__m256d b1 = _mm256_loadu_pd(b + 4);
+		__m256d ai;
+
+		ai = _mm256_broadcast_sd(a);
+		c00 = _mm256_fmadd_pd(ai, b0, c00);
+		c01 = _mm256_fmadd_pd(ai, b1, c01);
+		ai = _mm256_broadcast_sd(a + 1);
+		c10 = _mm256_fmadd_pd(ai, b0, c10);
+		c11 = _mm256_fmadd_pd(ai, b1, c11);
+		ai = _mm256_broadcast_sd(a + 2);
+		c20 = _mm256_fmadd_pd(ai, b0, c20);
+		c21 = _mm256_fmadd_pd(ai, b1, c21);
+		ai = _mm256_broadcast_sd(a + 3);
+		c30 = _mm256_fmadd_pd(ai, b0, c30);
+		c31 = _mm256_fmadd_pd(ai, b1, c31);
+		a += GEMM_MR;
+		b += GEMM_NR;
+	}
+
+	if ((mr == GEMM_MR) && (nr == GEMM_NR)) {
+		// Full tile is merged in registers
+		if (beta != 0) {
+			__m256d vb = _mm256_set1_pd(beta);
+			c00 = _mm256_fmadd_pd(vb, _mm256_loadu_pd(c), c00);
+			c01 = _mm256_fmadd_pd(vb, _mm256_loadu_pd(c + 4), c01);
+			c10 = _mm256_fmadd_pd(vb, _mm256_loadu_pd(c + ldc), c10);
+			c11 = _mm256_fmadd_pd(vb, _mm256_loadu_pd(c + ldc + 4), c11);
+			c20 = _mm256_fmadd_pd(vb, _mm256_loadu_pd(c + 2 * ldc), c20);
+			c21 = _mm256_fmadd_pd(vb,
+				_mm256_loadu_pd(c + 2 * ldc + 4), c21);
+			c30 = _mm256_fmadd_pd(vb, _mm256_loadu_pd(c + 3 * ldc), c30);
+			c31 = _mm256_fmadd_pd(vb,
+				_mm256_loadu_pd(c + 3 * ldc + 4), c31);
+		}
+		_mm256_storeu_pd(c, c00);
+		_mm256_storeu_pd(c + 4, c01);
+		_mm256_storeu_pd(c + ldc, c10);
+		_mm256_storeu_pd(c + ldc + 4, c11);
+		_mm256_storeu_pd(c + 2 * ldc, c20);
+		_mm256_storeu_pd(c + 2 * ldc + 4, c21);
+		_mm256_storeu_pd(c + 3 * ldc, c30);
+		_mm256_storeu_pd(c + 3 * ldc + 4, c31);
+	}
+	else {
+		double ab[GEMM_MR * GEMM_NR];
+
+		_mm256_storeu_pd(ab, c00);
+		_mm256_storeu_pd(ab + 4, c01);
+		_mm256_storeu_pd(ab + 8, c10);
+		_mm256_storeu_pd(ab + 12, c11);
+		_mm256_storeu_pd(ab + 16, c20);
+		_mm256_storeu_pd(ab + 20, c21);
+		_mm256_storeu_pd(ab + 24, c30);
+		_mm256_storeu_pd(ab + 28, c31);
+		_simd_merge(ab, c, ldc, mr, nr, beta);
+	}
+}
+
+SIMD_AVX2 void _avx2_add(const double *a, const double *b, double *r,
+	int n)
+{
+	int i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		_mm256_storeu_pd(r + i,
+			_mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+	}
+	_scalar_add(a + i, b + i, r + i, n - i);
+}
+
+SIMD_AVX2 void _avx2_sub(const double *a, const double *b, double *r,
+	int n)
+{
+	int i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		_mm256_storeu_pd(r + i,
+			_mm256_sub_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+	}
+	_scalar_sub(a + i, b + i, r + i, n - i);
+}
+
+SIMD_AVX2 void _avx2_axpy(double *y, double alpha, const double *x,
+	int n)
+{
+	__m256d va = _mm256_set1_pd(alpha);
+	int i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		_mm256_storeu_pd(y + i, _mm256_fmadd_pd(va, _mm256_loadu_pd(x + i),
+			_mm256_loadu_pd(y + i)));
+	}
+	_scalar_axpy(y + i, alpha, x + i, n - i);
+}
+
+SIMD_AVX2 void _avx2_split(const double *a, double *pos, double *neg,
+	int n)
+{
+	__m256d zero = _mm256_setzero_pd();
+	int i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		__m256d x = _mm256_loadu_pd(a + i);
+		__m256d mask = _mm256_cmp_pd(x, zero, _CMP_GT_OQ);
+		_mm256_storeu_pd(pos + i, _mm256_and_pd(mask, x));
+		_mm256_storeu_pd(neg + i, _mm256_andnot_pd(mask, x));
+	}
+	_scalar_split(a + i, pos + i, neg + i, n - i);
+}
+
+SIMD_AVX2 void _avx2_sqdiff_acc(double *acc, const double *a,
+	const double *b, int n)
+{
+	int i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		__m256d d = _mm256_sub_pd(_mm256_loadu_pd(a + i),
+			_mm256_loadu_pd(b + i));
+		_mm256_storeu_pd(acc + i, _mm256_add_pd(_mm256_loadu_pd(acc + i),
+			_mm256_mul_pd(d, d)));
+	}
+	_scalar_sqdiff_acc(acc + i, a + i, b + i, n - i);
+}
+
+SIMD_AVX2 void _avx2_update_w(double *w, const double *vh,
+	const double *whh, int n)
+{
+	__m256d zero = _mm256_setzero_pd();
+	int i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		__m256d a = _mm256_loadu_pd(vh + i);
+		__m256d b = _mm256_loadu_pd(whh + i);
+		__m256d ma = _mm256_cmp_pd(a, zero, _CMP_GT_OQ);
+		__m256d mb = _mm256_cmp_pd(b, zero, _CMP_GT_OQ);
+		__m256d num = _mm256_add_pd(_mm256_and_pd(ma, a),
+			_mm256_andnot_pd(mb, b));
+		__m256d den = _mm256_add_pd(_mm256_andnot_pd(ma, a),
+			_mm256_and_pd(mb, b));
+		_mm256_storeu_pd(w + i, _mm256_mul_pd(_mm256_loadu_pd(w + i),
+			_mm256_sqrt_pd(_mm256_div_pd(num, den))));
+	}
+	_scalar_update_w(w + i, vh + i, whh + i, n - i);
+}
+
+SIMD_AVX2 void _avx2_update_h(double *h, const double *wv,
+	const double *wwh, const double *sum_h, const double *n_sum_h,
+	double alpha, double weight, int n)
+{
+	__m256d zero = _mm256_setzero_pd();
+	__m256d va = _mm256_set1_pd(alpha);
+	__m256d vw = _mm256_set1_pd(weight);
+	int i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		__m256d x = _mm256_loadu_pd(h + i);
+		__m256d a = _mm256_loadu_pd(wv + i);
+		__m256d b = _mm256_loadu_pd(wwh + i);
+		__m256d mx = _mm256_cmp_pd(x, zero, _CMP_GT_OQ);
+		__m256d ma = _mm256_cmp_pd(a, zero, _CMP_GT_OQ);
+		__m256d mb = _mm256_cmp_pd(b, zero, _CMP_GT_OQ);
+		__m256d p = _mm256_and_pd(mx, x);
+		__m256d q = _mm256_andnot_pd(mx, x);
+		__m256d num = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(
+			_mm256_and_pd(ma, a), _mm256_andnot_pd(mb, b)),
+			_mm256_mul_pd(vw, q)),
+			_mm256_mul_pd(va, _mm256_sub_pd(_mm256_loadu_pd(sum_h + i), p)));
+		__m256d den = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(
+			_mm256_andnot_pd(ma, a), _mm256_and_pd(mb, b)),
+			_mm256_mul_pd(vw, p)),
+			_mm256_mul_pd(va, _mm256_sub_pd(_mm256_loadu_pd(n_sum_h + i), q)));
+		_mm256_storeu_pd(h + i, _mm256_mul_pd(x,
+			_mm256_sqrt_pd(_mm256_div_pd(num, den))));
+	}
+	_scalar_update_h(h + i, wv + i, wwh + i, sum_h + i, n_sum_h + i, alpha,
+		weight, n - i);
+}
+
+/*
+	Function: _avx2_combine
+	------------------------
+	Internal function. AVX2 version of combine. Sixteen columns are
+	accumulated in registers over all k rows of B before C is stored.
+*/
+SIMD_AVX2 void _avx2_combine(double *c, const double *coef,
+	const double *b, size_t ldb, int k, int n, double beta)
+{
+	__m256d vb = _mm256_set1_pd(beta);
+	int j = 0;
+
+	for (; j + 16 <= n; j += 16) {
+		__m256d c0 = _mm256_setzero_pd();
+		__m256d c1 = _mm256_setzero_pd();
+		__m256d c2 = _mm256_setzero_pd();
+		__m256d c3 = _mm256_setzero_pd();
+		const double *rowB = b + j;
+
+		if (beta != 0) {
+			c0 = _mm256_mul_pd(vb, _mm256_loadu_pd(c + j));
+			c1 = _mm256_mul_pd(vb, _mm256_loadu_pd(c + j + 4));
+			c2 = _mm256_mul_pd(vb, _mm256_loadu_pd(c + j + 8));
+			c3 = _mm256_mul_pd(vb, _mm256_loadu_pd(c + j + 12));
+		}
+		for (int p = 0; p < k; ++p) {
+			__m256d x = _mm256_broadcast_sd(coef + p);
+			c0 = _mm256_fmadd_pd(x, _mm256_loadu_pd(rowB), c0);
+			c1 = _mm256_fmadd_pd(x, _mm256_loadu_pd(rowB + 4), c1);
+			c2 = _mm256_fmadd_pd(x, _mm256_loadu_pd(rowB + 8), c2);
+			c3 = _mm256_fmadd_pd(x, _mm256_loadu_pd(rowB + 12), c3);
+			rowB += ldb;
+		}
+		_mm256_storeu_pd(c + j, c0);
+		_mm256_storeu_pd(c + j + 4, c1);
+		_mm256_storeu_pd(c + j + 8, c2);
+		_mm256_storeu_pd(c + j + 12, c3);
+	}
+	for (; j + 4 <= n; j += 4) {
+		__m256d c0 = _mm256_setzero_pd();
+		const double *rowB = b + j;
+
+		if (beta != 0) {
+			c0 = _mm256_mul_pd(vb, _mm256_loadu_pd(c + j));
+		}
+		for (int p = 0; p < k; ++p) {
+			c0 = _mm256_fmadd_pd(_mm256_broadcast_sd(coef + p),
+				_mm256_loadu_pd(rowB), c0);
+			rowB += ldb;
+		}
+		_mm256_storeu_pd(c + j, c0);
+	}
+	_scalar_combine(c + j, coef, b + j, ldb, k, n - j, beta);
+}
+
+/*
+	Function: _avx2_gather
+	-----------------------
+	Internal function. AVX2 version of gather. Like _avx2_combine(),
+	sixteen columns stay in registers over all k rows of B.
+*/
+SIMD_AVX2 void _avx2_gather(double *c, const double *coef,
+	const int *index, const double *b, size_t ldb, int k, int n,
+	double shift)
+{
+	int j = 0;
+
+	for (; j + 16 <= n; j += 16) {
+		__m256d c0 = _mm256_loadu_pd(c + j);
+		__m256d c1 = _mm256_loadu_pd(c + j + 4);
+		__m256d c2 = _mm256_loadu_pd(c + j + 8);
+		__m256d c3 = _mm256_loadu_pd(c + j + 12);
+
+		for (int p = 0; p < k; ++p) {
+			const double *rowB = b + index[p] * ldb + j;
+			__m256d x = _mm256_set1_pd(coef[p] - shift);
+			c0 = _mm256_fmadd_pd(x, _mm256_loadu_pd(rowB), c0);
+			c1 = _mm256_fmadd_pd(x, _mm256_loadu_pd(rowB + 4), c1);
+			c2 = _mm256_fmadd_pd(x, _mm256_loadu_pd(rowB + 8), c2);
+			c3 = _mm256_fmadd_pd(x, _mm256_loadu_pd(rowB + 12), c3);
+		}
+		_mm256_storeu_pd(c + j, c0);
+		_mm256_storeu_pd(c + j + 4, c1);
+		_mm256_storeu_pd(c + j + 8, c2);
+		_mm256_storeu_pd(c + j + 12, c3);
+	}
+	for (; j + 4 <= n; j += 4) {
+		__m256d c0 = _mm256_loadu_pd(c + j);
+
+		for (int p = 0; p < k; ++p) {
+			c0 = _mm256_fmadd_pd(_mm256_set1_pd(coef[p] - shift),
+				_mm256_loadu_pd(b + index[p] * ldb + j), c0);
+		}
+		_mm256_storeu_pd(c + j, c0);
+	}
+	_scalar_gather(c + j, coef, index, b + j, ldb, k, n - j, shift);
+}
+
+SIMD_AVX2 double _avx2_dot(const double *a, const double *b, int n)
+{
+	__m256d acc0 = _mm256_setzero_pd();
+	__m256d acc1 = _mm256_setzero_pd();
+	double part[4];
+	int i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i),
+			_mm256_loadu_pd(b + i), acc0);
+		acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 4),
+			_mm256_loadu_pd(b + i + 4), acc1);
+	}
+	_mm256_storeu_pd(part, _mm256_add_pd(acc0, acc1));
+
+	return (part[0] + part[1]) + (part[2] + part[3]) +
+		_scalar_dot(a + i, b + i, n - i);
+}
+
+/*
+	Function: _avx2_lanes_syrk
+	---------------------------
+	Internal function. AVX2 version of lanes_syrk. Every entry of the
+	triangle is kept in two registers, one per half of the lanes.
+*/
+SIMD_AVX2 void _avx2_lanes_syrk(const double *a, int n, int kb,
+	double *acc)
+{
+	size_t step = (size_t)n * SIMD_LANES;
+
+	for (int i = 0; i < n; ++i) {
+		for (int j = 0; j <= i; ++j) {
+			double *sum = acc + (i * (i + 1) / 2 + j) * SIMD_LANES;
+			const double *x = a + i * SIMD_LANES;
+			const double *y = a + j * SIMD_LANES;
+			__m256d s0 = _mm256_loadu_pd(sum);
+			__m256d s1 = _mm256_loadu_pd(sum + 4);
+
+			for (int p = 0; p < kb; ++p) {
+				s0 = _mm256_fmadd_pd(_mm256_loadu_pd(x),
+					_mm256_loadu_pd(y), s0);
+				s1 = _mm256_fmadd_pd(_mm256_loadu_pd(x + 4),
+					_mm256_loadu_pd(y + 4), s1);
+				x += step;
+				y += step;
+			}
+			_mm256_storeu_pd(sum, s0);
+			_mm256_storeu_pd(sum + 4, s1);
+		}
+	}
+}
+
+/*
+	Function: _avx2_transpose
+	--------------------------
+	Internal function. AVX2 version of transpose, also used on AVX-512
+	processors. Blocks of 4 x 4 are transposed in registers, and rows of
+	R are written four entries at a time. Streaming stores are ordered
+	by a fence before returning.
+*/
+SIMD_AVX2 void _avx2_transpose(const double *a, size_t lda, double *r,
+	size_t ldr, int rows, int cols, bool stream)
+{
+	int j = 0;
+
+	for (; j + 4 <= cols; j += 4) {
+		double *r0 = r + j * ldr;
+		int i = 0;
+
+		for (; i + 4 <= rows; i += 4) {
+			const double *a0 = a + i * lda + j;
+			__m256d x0 = _mm256_loadu_pd(a0);
+			__m256d x1 = _mm256_loadu_pd(a0 + lda);
+			__m256d x2 = _mm256_loadu_pd(a0 + 2 * lda);
+			__m256d x3 = _mm256_loadu_pd(a0 + 3 * lda);
+			__m256d t0 = _mm256_unpacklo_pd(x0, x1);
+			__m256d t1 = _mm256_unpackhi_pd(x0, x1);
+			__m256d t2 = _mm256_unpacklo_pd(x2, x3);
+			__m256d t3 = _mm256_unpackhi_pd(x2, x3);
+
+			x0 = _mm256_permute2f128_pd(t0, t2, 0x20);
+			x1 = _mm256_permute2f128_pd(t1, t3, 0x20);
+			x2 = _mm256_permute2f128_pd(t0, t2, 0x31);
+			x3 = _mm256_permute2f128_pd(t1, t3, 0x31);
+			if (stream) {
+				_mm256_stream_pd(r0 + i, x0);
+				_mm256_stream_pd(r0 + ldr + i, x1);
+				_mm256_stream_pd(r0 + 2 * ldr + i, x2);
+				_mm256_stream_pd(r0 + 3 * ldr + i, x3);
+			}
+			else {
+				_mm256_storeu_pd(r0 + i, x0);
+				_mm256_storeu_pd(r0 + ldr + i, x1);
+				_mm256_storeu_pd(r0 + 2 * ldr + i, x2);
+				_mm256_storeu_pd(r0 + 3 * ldr + i, x3);
+			}
+		}
+		_scalar_transpose(a + i * lda + j, lda, r0 + i, ldr, rows - i, 4,
+			false);
+	}
+	_scalar_transpose(a + j, lda, r + j * ldr, ldr, rows, cols - j, false);
+	if (stream) {
+		_mm_sfence();
+	}
+}
+
+SIMD_AVX2 void _avx2_widen(const float *a, double *r, int n)
+{
+	int i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		_mm256_storeu_pd(r + i, _mm256_cvtps_pd(_mm_loadu_ps(a + i)));
+	}
+	_scalar_widen(a + i, r + i, n - i);
+}
+
+SIMD_AVX2 void _avx2_narrow(const double *a, float *r, int n)
+{
+	int i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		_mm_storeu_ps(r + i, _mm256_cvtpd_ps(_mm256_loadu_pd(a + i)));
+	}
+	_scalar_narrow(a + i, r + i, n - i);
+}
+
+/*
+	Function: _avx2_decode_u8
+	--------------------------
+	Internal function. AVX2 version of decode_u8. Four codes are zero
+	extended to integers and converted to doubles at a time, and code 0
+	is blended with the fill. Codes are scaled without FMA, so they
+	decode to the same doubles as in the scalar kernel and in the GEMM
+	packing.
+*/
+SIMD_AVX2 void _avx2_decode_u8(const unsigned char *a, double scale,
+	double bias, double fill, double *r, int n)
+{
+	__m256d vs = _mm256_set1_pd(scale);
+	__m256d vb = _mm256_set1_pd(bias);
+	__m256d vf = _mm256_set1_pd(fill);
+	__m256d zero = _mm256_setzero_pd();
+	int i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		int codes;
+		__m256d x;
+
+		memcpy(&codes, a + i, sizeof(codes));
+		x = _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(codes)));
+		_mm256_storeu_pd(r + i, _mm256_blendv_pd(
+			_mm256_add_pd(vb, _mm256_mul_pd(vs, x)), vf,
+			_mm256_cmp_pd(x, zero, _CMP_EQ_OQ)));
+	}
+	_scalar_decode_u8(a + i, scale, bias, fill, r + i, n - i);
+}
+
+SIMD_AVX2 void _avx2_decode_u16(const unsigned short *a, double scale,
+	double bias, double fill, double *r, int n)
+{
+	__m256d vs = _mm256_set1_pd(scale);
+	__m256d vb = _mm256_set1_pd(bias);
+	__m256d vf = _mm256_set1_pd(fill);
+	__m256d zero = _mm256_setzero_pd();
+	int i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		__m256d x = _mm256_cvtepi32_pd(_mm_cvtepu16_epi32(
+			_mm_loadl_epi64((const __m128i*)(a + i))));
+		_mm256_storeu_pd(r + i, _mm256_blendv_pd(
+			_mm256_add_pd(vb, _mm256_mul_pd(vs, x)), vf,
+			_mm256_cmp_pd(x, zero, _CMP_EQ_OQ)));
+	}
+	_scalar_decode_u16(a + i, scale, bias, fill, r + i, n - i);
+}
+
+#ifdef SIMD_HAS_AVX512
+
+/*	AVX-512 kernels	*/
+
+/*
+	Function: _avx512_gemm_kernel
+	------------------------------
+	Internal function. AVX-512 version of the micro-kernel. Each tile
+	row fits one 512-bit register; the depth loop is unrolled twice with
+	separate accumulators to hide FMA latency.
+*/
+SIMD_AVX512 void _avx512_gemm_kernel(int kc, const double *a,
+	const double *b, double *c, size_t ldc, int mr, int nr, double beta)
+{
+	__m512d c0 = _mm512_setzero_pd();
+	__m512d c1 = _mm512_setzero_pd();
+	__m512d c2 = _mm512_setzero_pd();
+	__m512d c3 = _mm512_setzero_pd();
+	__m512d d0 = _mm512_setzero_pd();
+	__m512d d1 = _mm512_setzero_pd();
+	__m512d d2 = _mm512_setzero_pd();
+	__m512d d3 = _mm512_setzero_pd();
+	int p = 0;
+
+	for (; p + 2 <= kc; p += 2) {
+		__m512d b0 = _mm512_loadu_pd(b);
+		__m512d b1 = _mm512_loadu_pd(b + GEMM_NR);
+		c0 = _mm512_fmadd_pd(_mm512_set1_pd(a[0]), b0, c0);
+		c1 = _mm512_fmadd_pd(_mm512_set1_pd(a[1]), b0, c1);
+		c2 = _mm512_fmadd_pd(_mm512_set1_pd(a[2]), b0, c2);
+		c3 = _mm512_fmadd_pd(_mm512_set1_pd(a[3]), b0, c3);
+		d0 = _mm512_fmadd_pd(_mm512_set1_pd(a[4]), b1, d0);
+		d1 = _mm512_fmadd_pd(_mm512_set1_pd(a[5]), b1, d1);
+		d2 = _mm512_fmadd_pd(_mm512_set1_pd(a[6]), b1, d2);
+		d3 = _mm512_fmadd_pd(_mm512_set1_pd(a[7]), b1, d3);
+		a += 2 * GEMM_MR;
+		b += 2 * GEMM_NR;
+	}
+	if (p < kc) {
+		__m512d b0 = _mm512_loadu_pd(b);
+		c0 = _mm512_fmadd_pd(_mm512_set1_pd(a[0]), b0, c0);
+		c1 = _mm512_fmadd_pd(_mm512_set1_pd(a[1]), b0, c1);
+		c2 = _mm512_fmadd_pd(_mm512_set1_pd(a[2]), b0, c2);
+		c3 = _mm512_fmadd_pd(_mm512_set1_pd(a[3]), b0, c3);
+	}
+	c0 = _mm512_add_pd(c0, d0);
+	c1 = _mm512_add_pd(c1, d1);
+	c2 = _mm512_add_pd(c2, d2);
+	c3 = _mm512_add_pd(c3, d3);
+
+	if ((mr == GEMM_MR) && (nr == GEMM_NR)) {
+		// Full tile is merged in registers
+		if (beta != 0) {
+			__m512d vb = _mm512_set1_pd(beta);
+			c0 = _mm512_fmadd_pd(vb, _mm512_loadu_pd(c), c0);
+			c1 = _mm512_fmadd_pd(vb, _mm512_loadu_pd(c + ldc), c1);
+			c2 = _mm512_fmadd_pd(vb, _mm512_loadu_pd(c + 2 * ldc), c2);
+			c3 = _mm512_fmadd_pd(vb, _mm512_loadu_pd(c + 3 * ldc), c3);
+		}
+		_mm512_storeu_pd(c, c0);
+		_mm512_storeu_pd(c + ldc, c1);
+		_mm512_storeu_pd(c + 2 * ldc, c2);
+		_mm512_storeu_pd(c + 3 * ldc, c3);
+	}
+	else {
+		double ab[GEMM_MR * GEMM_NR];
+
+		_mm512_storeu_pd(ab, c0);
+		_mm512_storeu_pd(ab + 8, c1);
+		_mm512_storeu_pd(ab + 16, c2);
+		_mm512_storeu_pd(ab + 24, c3);
+		_simd_merge(ab, c, ldc, mr, nr, beta);
+	}
+}
+
+SIMD_AVX512 void _avx512_add(const double *a, const double *b, double *r,
+	int n)
+{
+	int i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		_mm512_storeu_pd(r + i,
+			_mm512_add_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i)));
+	}
+	_scalar_add(a + i, b + i, r + i, n - i);
+}
+
+SIMD_AVX512 void _avx512_sub(const double *a, const double *b, double *r,
+	int n)
+{
+	int i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		_mm512_storeu_pd(r + i,
+			_mm512_sub_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i)));
+	}
+	_scalar_sub(a + i, b + i, r + i, n - i);
+}
+
+SIMD_AVX512 void _avx512_axpy(double *y, double alpha, const double *x,
+	int n)
+{
+	__m512d va = _mm512_set1_pd(alpha);
+	int i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		_mm512_storeu_pd(y + i, _mm512_fmadd_pd(va, _mm512_loadu_pd(x + i),
+			_mm512_loadu_pd(y + i)));
+	}
+	_scalar_axpy(y + i, alpha, x + i, n - i);
+}
+
+SIMD_AVX512 void _avx512_split(const double *a, double *pos, double *neg,
+	int n)
+{
+	__m512d zero = _mm512_setzero_pd();
+	int i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		__m512d x = _mm512_loadu_pd(a + i);
+		__mmask8 mask = _mm512_cmp_pd_mask(x, zero, _CMP_GT_OQ);
+		_mm512_storeu_pd(pos + i, _mm512_maskz_mov_pd(mask, x));
+		_mm512_storeu_pd(neg + i, _mm512_maskz_mov_pd((__mmask8)~mask, x));
+	}
+	_scalar_split(a + i, pos + i, neg + i, n - i);
+}
+
+SIMD_AVX512 void _avx512_sqdiff_acc(double *acc, const double *a,
+	const double *b, int n)
+{
+	int i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		__m512d d = _mm512_sub_pd(_mm512_loadu_pd(a + i),
+			_mm512_loadu_pd(b + i));
+		_mm512_storeu_pd(acc + i, _mm512_add_pd(_mm512_loadu_pd(acc + i),
+			_mm512_mul_pd(d, d)));
+	}
+	_scalar_sqdiff_acc(acc + i, a + i, b + i, n - i);
+}
+
+SIMD_AVX512 void _avx512_update_w(double *w, const double *vh,
+	const double *whh, int n)
+{
+	__m512d zero = _mm512_setzero_pd();
+	int i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		__m512d a = _mm512_loadu_pd(vh + i);
+		__m512d b = _mm512_loadu_pd(whh + i);
+		__mmask8 ma = _mm512_cmp_pd_mask(a, zero, _CMP_GT_OQ);
+		__mmask8 mb = _mm512_cmp_pd_mask(b, zero, _CMP_GT_OQ);
+		__m512d num = _mm512_add_pd(_mm512_maskz_mov_pd(ma, a),
+			_mm512_maskz_mov_pd((__mmask8)~mb, b));
+		__m512d den = _mm512_add_pd(_mm512_maskz_mov_pd((__mmask8)~ma, a),
+			_mm512_maskz_mov_pd(mb, b));
+		_mm512_storeu_pd(w + i, _mm512_mul_pd(_mm512_loadu_pd(w + i),
+			_mm512_sqrt_pd(_mm512_div_pd(num, den))));
+	}
+	_scalar_update_w(w + i, vh + i, whh + i, n - i);
+}
+
+SIMD_AVX512 void _avx512_update_h(double *h, const double *wv,
+	const double *wwh, const double *sum_h, const double *n_sum_h,
+	double alpha, double weight, int n)
+{
+	__m512d zero = _mm512_setzero_pd();
+	__m512d va = _mm512_set1_pd(alpha);
+	__m512d vw = _mm512_set1_pd(weight);
+	int i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		__m512d x = _mm512_loadu_pd(h + i);
+		__m512d a = _mm512_loadu_pd(wv + i);
+		__m512d b = _mm512_loadu_pd(wwh + i);
+		__mmask8 mx = _mm512_cmp_pd_mask(x, zero, _CMP_GT_OQ);
+		__mmask8 ma = _mm512_cmp_pd_mask(a, zero, _CMP_GT_OQ);
+		__mmask8 mb = _mm512_cmp_pd_mask(b, zero, _CMP_GT_OQ);
+		__m512d p = _mm512_maskz_mov_pd(mx, x);
+		__m512d q = _mm512_maskz_mov_pd((__mmask8)~mx, x);
+		__m512d num = _mm512_add_pd(_mm512_add_pd(_mm512_add_pd(
+			_mm512_maskz_mov_pd(ma, a), _mm512_maskz_mov_pd((__mmask8)~mb, b)),
+			_mm512_mul_pd(vw, q)),
+			_mm512_mul_pd(va, _mm512_sub_pd(_mm512_loadu_pd(sum_h + i), p)));
+		__m512d den = _mm512_add_pd(_mm512_add_pd(_mm512_add_pd(
+			_mm512_maskz_mov_pd((__mmask8)~ma, a), _mm512_maskz_mov_pd(mb, b)),
+			_mm512_mul_pd(vw, p)),
+			_mm512_mul_pd(va, _mm512_sub_pd(_mm512_loadu_pd(n_sum_h + i), q)));
+		_mm512_storeu_pd(h + i, _mm512_mul_pd(x,
+			_mm512_sqrt_pd(_mm512_div_pd(num, den))));
+	}
+	_scalar_update_h(h + i, wv + i, wwh + i, sum_h + i, n_sum_h + i, alpha,
+		weight, n - i);
+}
+
+SIMD_AVX512 void _avx512_combine(double *c, const double *coef,
+	const double *b, size_t ldb, int k, int n, double beta)
+{
+	__m512d vb = _mm512_set1_pd(beta);
+	int j = 0;
+
+	for (; j + 32 <= n; j += 32) {
+		__m512d c0 = _mm512_setzero_pd();
+		__m512d c1 = _mm512_setzero_pd();
+		__m512d c2 = _mm512_setzero_pd();
+		__m512d c3 = _mm512_setzero_pd();
+		const double *rowB = b + j;
+
+		if (beta != 0) {
+			c0 = _mm512_mul_pd(vb, _mm512_loadu_pd(c + j));
+			c1 = _mm512_mul_pd(vb, _mm512_loadu_pd(c + j + 8));
+			c2 = _mm512_mul_pd(vb, _mm512_loadu_pd(c + j + 16));
+			c3 = _mm512_mul_pd(vb, _mm512_loadu_pd(c + j + 24));
+		}
+		for (int p = 0; p < k; ++p) {
+			__m512d x = _mm512_set1_pd(coef[p]);
+			c0 = _mm512_fmadd_pd(x, _mm512_loadu_pd(rowB), c0);
+			c1 = _mm512_fmadd_pd(x, _mm512_loadu_pd(rowB + 8), c1);
+			c2 = _mm512_fmadd_pd(x, _mm512_loadu_pd(rowB + 16), c2);
+			c3 = _mm512_fmadd_pd(x, _mm512_loadu_pd(rowB + 24), c3);
+			rowB += ldb;
+		}
+		_mm512_storeu_pd(c + j, c0);
+		_mm512_storeu_pd(c + j + 8, c1);
+		_mm512_storeu_pd(c + j + 16, c2);
+		_mm512_storeu_pd(c + j + 24, c3);
+	}
+	for (; j + 8 <= n; j += 8) {
+		__m512d c0 = _mm512_setzero_pd();
+		const double *rowB = b + j;
+
+		if (beta != 0) {
+			c0 = _mm512_mul_pd(vb, _mm512_loadu_pd(c + j));
+		}
+		for (int p = 0; p < k; ++p) {
+			c0 = _mm512_fmadd_pd(_mm512_set1_pd(coef[p]),
+				_mm512_loadu_pd(rowB), c0);
+			rowB += ldb;
+		}
+		_mm512_storeu_pd(c + j, c0);
+	}
+	_scalar_combine(c + j, coef, b + j, ldb, k, n - j, beta);
+}
+
+SIMD_AVX512 void _avx512_gather(double *c, const double *coef,
+	const int *index, const double *b, size_t ldb, int k, int n,
+	double shift)
+{
+	int j = 0;
+
+	for (; j + 32 <= n; j += 32) {
+		__m512d c0 = _mm512_loadu_pd(c + j);
+		__m512d c1 = _mm512_loadu_pd(c + j + 8);
+		__m512d c2 = _mm512_loadu_pd(c + j + 16);
+		__m512d c3 = _mm512_loadu_pd(c + j + 24);
+
+		for (int p = 0; p < k; ++p) {
+			const double *rowB = b + index[p] * ldb + j;
+			__m512d x = _mm512_set1_pd(coef[p] - shift);
+			c0 = _mm512_fmadd_pd(x, _mm512_loadu_pd(rowB), c0);
+			c1 = _mm512_fmadd_pd(x, _mm512_loadu_pd(rowB + 8), c1);
+			c2 = _mm512_fmadd_pd(x, _mm512_loadu_pd(rowB + 16), c2);
+			c3 = _mm512_fmadd_pd(x, _mm512_loadu_pd(rowB + 24), c3);
+		}
+		_mm512_storeu_pd(c + j, c0);
+		_mm512_storeu_pd(c + j + 8, c1);
+		_mm512_storeu_pd(c + j + 16, c2);
+		_mm512_storeu_pd(c + j + 24, c3);
+	}
+	for (; j + 8 <= n; j += 8) {
+		__m512d c0 = _mm512_loadu_pd(c + j);
+
+		for (int p = 0; p < k; ++p) {
+			c0 = _mm512_fmadd_pd(_mm512_set1_pd(coef[p] - shift),
+				_mm512_loadu_pd(b + index[p] * ldb + j), c0);
+		}
+		_mm512_storeu_pd(c + j, c0);
+	}
+	_scalar_gather(c + j, coef, index, b + j, ldb, k, n - j, shift);
+}
+
+SIMD_AVX512 double _avx512_dot(const double *a, const double *b, int n)
+{
+	__m512d acc0 = _mm512_setzero_pd();
+	__m512d acc1 = _mm512_setzero_pd();
+	int i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		acc0 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i),
+			_mm512_loadu_pd(b + i), acc0);
+		acc1 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i + 8),
+			_mm512_loadu_pd(b + i + 8), acc1);
+	}
+
+	return _mm512_reduce_add_pd(_mm512_add_pd(acc0, acc1)) +
+		_scalar_dot(a + i, b + i, n - i);
+}
+
+/*
+	Function: _avx512_lanes_syrk
+	-----------------------------
+	Internal function. AVX-512 version of lanes_syrk. All lanes of an
+	entry fit one register, two registers split the columns of A to
+	hide the latency of FMA.
+*/
+SIMD_AVX512 void _avx512_lanes_syrk(const double *a, int n, int kb,
+	double *acc)
+{
+	size_t step = (size_t)n * SIMD_LANES;
+
+	for (int i = 0; i < n; ++i) {
+		for (int j = 0; j <= i; ++j) {
+			double *sum = acc + (i * (i + 1) / 2 + j) * SIMD_LANES;
+			const double *x = a + i * SIMD_LANES;
+			const double *y = a + j * SIMD_LANES;
+			__m512d s0 = _mm512_loadu_pd(sum);
+			__m512d s1 = _mm512_setzero_pd();
+			int p = 0;
+
+			for (; p + 2 <= kb; p += 2) {
+				s0 = _mm512_fmadd_pd(_mm512_loadu_pd(x),
+					_mm512_loadu_pd(y), s0);
+				s1 = _mm512_fmadd_pd(_mm512_loadu_pd(x + step),
+					_mm512_loadu_pd(y + step), s1);
+				x += 2 * step;
+				y += 2 * step;
+			}
+			if (p < kb) {
+				s0 = _mm512_fmadd_pd(_mm512_loadu_pd(x),
+					_mm512_loadu_pd(y), s0);
+			}
+			_mm512_storeu_pd(sum, _mm512_add_pd(s0, s1));
+		}
+	}
+}
+
+SIMD_AVX512 void _avx512_widen(const float *a, double *r, int n)
+{
+	int i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		_mm512_storeu_pd(r + i, _mm512_cvtps_pd(_mm256_loadu_ps(a + i)));
+	}
+	_scalar_widen(a + i, r + i, n - i);
+}
+
+SIMD_AVX512 void _avx512_narrow(const double *a, float *r, int n)
+{
+	int i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		_mm256_storeu_ps(r + i, _mm512_cvtpd_ps(_mm512_loadu_pd(a + i)));
+	}
+	_scalar_narrow(a + i, r + i, n - i);
+}
+
+SIMD_AVX512 void _avx512_decode_u8(const unsigned char *a, double scale,
+	double bias, double fill, double *r, int n)
+{
+	__m512d vs = _mm512_set1_pd(scale);
+	__m512d vb = _mm512_set1_pd(bias);
+	__m512d vf = _mm512_set1_pd(fill);
+	__m512d zero = _mm512_setzero_pd();
+	int i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		__m512d x = _mm512_cvtepi32_pd(_mm256_cvtepu8_epi32(
+			_mm_loadl_epi64((const __m128i*)(a + i))));
+		_mm512_storeu_pd(r + i, _mm512_mask_mov_pd(
+			_mm512_add_pd(vb, _mm512_mul_pd(vs, x)),
+			_mm512_cmp_pd_mask(x, zero, _CMP_EQ_OQ), vf));
+	}
+	_scalar_decode_u8(a + i, scale, bias, fill, r + i, n - i);
+}
+
+SIMD_AVX512 void _avx512_decode_u16(const unsigned short *a, double scale,
+	double bias, double fill, double *r, int n)
+{
+	__m512d vs = _mm512_set1_pd(scale);
+	__m512d vb = _mm512_set1_pd(bias);
+	__m512d vf = _mm512_set1_pd(fill);
+	__m512d zero = _mm512_setzero_pd();
+	int i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		__m512d x = _mm512_cvtepi32_pd(_mm256_cvtepu16_epi32(
+			_mm_loadu_si128((const __m128i*)(a + i))));
+		_mm512_storeu_pd(r + i, _mm512_mask_mov_pd(
+			_mm512_add_pd(vb, _mm512_mul_pd(vs, x)),
+			_mm512_cmp_pd_mask(x, zero, _CMP_EQ_OQ), vf));
+	}
+	_scalar_decode_u16(a + i, scale, bias, fill, r + i, n - i);
+}
+
+#endif
+
+/*
+	Function: _simd_cpuid
+	----------------------
+	Internal function. Reads a CPUID leaf.
+
+	Parameters:
+	leaf - CPUID leaf
+	sub - CPUID sub-leaf
+	regs - EAX, EBX, ECX and EDX outputs
+*/
+void _simd_cpuid(int leaf, int sub, unsigned int regs[4])
+{
+#ifdef _MSC_VER
+	__cpuidex((int*)regs, leaf, sub);
+#else
+	__cpuid_count(leaf, sub, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+/*
+	Function: _simd_xgetbv
+	-----------------------
+	Internal function. Reads register states enabled by the operating
+	system.
+
+	Returns:
+	low word of XCR0
+*/
+unsigned int _simd_xgetbv()
+{
+#ifdef _MSC_VER
+	return (unsigned int)_xgetbv(0);
+#else
+	unsigned int eax;
+	unsigned int edx;
+	__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return eax;
+#endif
+}
+
+#endif
+
+/*
+	Function: simd_initialize
+	--------------------------
+	Selects the widest kernels supported by both the processor and the
+	operating system. Scalar kernels stay selected otherwise.
+*/
+void simd_initialize()
+{
+#ifdef SIMD_X86
+	unsigned int regs[4];
+	unsigned int xcr0;
+	bool hasAvx2;
+
+	_simd_cpuid(0, 0, regs);
+	if (regs[0] < 7) {
+		return;
+	}
+	_simd_cpuid(1, 0, regs);
+	// OSXSAVE, AVX and FMA
+	if (!(regs[2] & (1u << 27)) || !(regs[2] & (1u << 28)) ||
+		!(regs[2] & (1u << 12))) {
+		return;
+	}
+	xcr0 = _simd_xgetbv();
+	if ((xcr0 & 0x6) != 0x6) {
+		// YMM states are not saved by the operating system
+		return;
+	}
+	_simd_cpuid(7, 0, regs);
+	hasAvx2 = (regs[1] & (1u << 5)) != 0;
+
+#ifdef SIMD_HAS_AVX512
+	// AVX512F, and opmask and ZMM states saved by the operating system
+	if (hasAvx2 && (regs[1] & (1u << 16)) && ((xcr0 & 0xe6) == 0xe6)) {
+		simd.name = "AVX-512";
+		simd.isa = ISA_AVX512;
+		simd.gemm_kernel = _avx512_gemm_kernel;
+		simd.add = _avx512_add;
+		simd.sub = _avx512_sub;
+		simd.axpy = _avx512_axpy;
+		simd.split = _avx512_split;
+		simd.sqdiff_acc = _avx512_sqdiff_acc;
+		simd.update_w = _avx512_update_w;
+		simd.update_h = _avx512_update_h;
+		simd.combine = _avx512_combine;
+		simd.gather = _avx512_gather;
+		simd.dot = _avx512_dot;
+		simd.lanes_syrk = _avx512_lanes_syrk;
+		simd.transpose = _avx2_transpose;
+		simd.widen = _avx512_widen;
+		simd.narrow = _avx512_narrow;
+		simd.decode_u8 = _avx512_decode_u8;
+		simd.decode_u16 = _avx512_decode_u16;
+		return;
+	}
+#endif
+	if (hasAvx2) {
+		simd.name = "AVX2";
+		simd.isa = ISA_AVX2;
+		simd.gemm_kernel = _avx2_gemm_kernel;
+		simd.add = _avx2_add;
+		simd.sub = _avx2_sub;
+		simd.axpy = _avx2_axpy;
+		simd.split = _avx2_split;
+		simd.sqdiff_acc = _avx2_sqdiff_acc;
+		simd.update_w = _avx2_update_w;
+		simd.update_h = _avx2_update_h;
+		simd.combine = _avx2_combine;
+		simd.gather = _avx2_gather;
+		simd.dot = _avx2_dot;
+		simd.lanes_syrk = _avx2_lanes_syrk;
+		simd.transpose = _avx2_transpose;
+		simd.widen = _avx2_widen;
+		simd.narrow = _avx2_narrow;
+		simd.decode_u8 = _avx2_decode_u8;
+		simd.decode_u16 = _avx2_decode_u16;
+	}
+#endif
+}
@@ -0,0 +1,611 @@
+#include "sparse.h"
+#include "simd.h"
+#include "threadpool.h"
+#include "allocator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Product of a compressed matrix with a dense matrix, by lines, see
+// _sparse_lines()
+typedef struct Sparse_Job
+{
+	int lines;	// Number of compressed lines
+	const size_t *start;	// Start of every line
+	const int *index;	// Positions of stored entries in their lines
+	const double *value;	// Stored entries
+	double fill;	// Entry at every position that is not stored
+	const double *b;	// Dense rows combined by every line
+	size_t ldb;	// Leading dimension of b
+	int n;	// Columns of b and of the result
+	const double *sums;	// Sums of all rows of b
+	Matrix *r;	// Result, one row per line
+} Sparse_Job;
+
+// Predictions at stored positions, see sparse_predict()
+typedef struct Predict_Job
+{
+	const Sparse *a;	// Stored entries
+	Sparse *p;	// Predictions at the positions of a
+	const Matrix *w;	// Rows of users
+	const Matrix *ht;	// Transposed H, rows of items
+	double *partial;	// Squared residuals of every strip of rows
+} Predict_Job;
+
+void *_sparse_alloc(size_t);
+void _sparse_transpose(int, int, const size_t*, const int*, const double*,
+	size_t*, int*, double*);
+void _sparse_dedup(Sparse*);
+void _sparse_lines(void*, int, int);
+void _sparse_predict_rows(void*, int, int);
+void _sparse_predict_cols(void*, int, int);
+
+/*
+	Function: sparse_new
+	---------------------
+	Creates an empty sparse matrix, whose entries are counted next, see
+	sparse_count().
+
+	Parameters:
+	r - row number
+	c - column number
+
+	Returns:
+	new sparse matrix without stored entries
+*/
+Sparse sparse_new(int r, int c)
+{
+	Sparse result;
+
+	result.rows = r;
+	result.cols = c;
+	result.nnz = 0;
+	result.start = (size_t*)_sparse_alloc((r + 1) * sizeof(size_t));
+	memset(result.start, 0, (r + 1) * sizeof(size_t));
+	result.index = NULL;
+	result.value = NULL;
+	result.col_start = NULL;
+	result.row_index = NULL;
+	result.col_value = NULL;
+	result.fill = 0;
+
+	return result;
+}
+
+/*
+	Function: sparse_count
+	-----------------------
+	Counts one stored entry in a row. Counts are kept one row ahead, so
+	that sparse_reserve() turns them into row starts in place.
+
+	Parameters:
+	a - sparse matrix being counted
+	i - row of the entry
+*/
+void sparse_count(Sparse *a, int i)
+{
+	++a->start[i + 1];
+}
+
+/*
+	Function: sparse_reserve
+	-------------------------
+	Allocates the counted entries. Row starts then serve as insertion
+	points of sparse_insert(), each moving to the end of its row.
+
+	Parameters:
+	a - counted sparse matrix
+*/
+void sparse_reserve(Sparse *a)
+{
+	for (int i = 0; i < a->rows; ++i) {
+		a->start[i + 1] += a->start[i];
+	}
+	a->nnz = a->start[a->rows];
+	a->index = (int*)_sparse_alloc(a->nnz * sizeof(int));
+	a->value = (double*)_sparse_alloc(a->nnz * sizeof(double));
+}
+
+/*
+	Function: sparse_insert
+	------------------------
+	Stores an entry at the insertion point of its row. Every row takes
+	exactly the entries counted for it.
+
+	Parameters:
+	a - reserved sparse matrix
+	i - row of the entry
+	j - column of the entry
+	x - entry
+*/
+void sparse_insert(Sparse *a, int i, int j, double x)
+{
+	size_t p = a->start[i]++;
+
+	a->index[p] = j;
+	a->value[p] = x;
+}
+
+/*
+	Function: sparse_finish
+	------------------------
+	Restores row starts after all insertions, and sorts every row by
+	columns. Sorting goes through the compressed columns: both
+	transposes are stable counting sorts, so entries of one position stay
+	in insertion order and the latest of them is kept, as if it had
+	overwritten a dense matrix.
+
+	Parameters:
+	a - sparse matrix with all its entries inserted
+*/
+void sparse_finish(Sparse *a)
+{
+	// Insertion points have moved to the starts of the next rows
+	for (int i = a->rows; i > 0; --i) {
+		a->start[i] = a->start[i - 1];
+	}
+	a->start[0] = 0;
+
+	a->col_start = (size_t*)_sparse_alloc((a->cols + 1) * sizeof(size_t));
+	a->row_index = (int*)_sparse_alloc(a->nnz * sizeof(int));
+	a->col_value = (double*)_sparse_alloc(a->nnz * sizeof(double));
+	_sparse_transpose(a->rows, a->cols, a->start, a->index, a->value,
+		a->col_start, a->row_index, a->col_value);
+	_sparse_transpose(a->cols, a->rows, a->col_start, a->row_index,
+		a->col_value, a->start, a->index, a->value);
+	_sparse_dedup(a);
+	_sparse_transpose(a->rows, a->cols, a->start, a->index, a->value,
+		a->col_start, a->row_index, a->col_value);
+}
+
+/*
+	Function: sparse_free
+	----------------------
+	Releases the entries of a sparse matrix.
+
+	Parameters:
+	a - sparse matrix
+*/
+void sparse_free(Sparse *a)
+{
+	buffer_free(a->start);
+	buffer_free(a->index);
+	buffer_free(a->value);
+	buffer_free(a->col_start);
+	buffer_free(a->row_index);
+	buffer_free(a->col_value);
+	a->start = NULL;
+	a->index = NULL;
+	a->value = NULL;
+	a->col_start = NULL;
+	a->row_index = NULL;
+	a->col_value = NULL;
+	a->rows = 0;
+	a->cols = 0;
+	a->nnz = 0;
+}
+
+/*
+	Function: sparse_multiply_nt
+	-----------------------------
+	Calculates A transpose(B) into an existing matrix R. B is transposed
+	into a thread work buffer first, so that every stored entry of A
+	combines one contiguous row of it. Positions that are not stored add
+	fill times the row sums of B.
+
+	Parameters:
+	r - result, rows of A x rows of B
+	a - sparse matrix
+	b - double matrix with the columns of A
+*/
+void sparse_multiply_nt(Matrix *r, const Sparse *a, const Matrix *b)
+{
+	size_t size = (size_t)b->cols * b->rows;
+	double *buffer = (double*)pool_scratch(SCRATCH_SPARSE,
+		(size + b->rows) * sizeof(double));
+	Matrix bt = matrix_wrap(buffer, b->cols, b->rows);
+	double *sums = buffer + size;
+	Sparse_Job job;
+
+	matrix_transpose(&bt, b);
+	for (int i = 0; i < b->rows; ++i) {
+		const double *rowB = MATRIX_ROW(*b, i);
+		double value = 0;
+
+		for (int j = 0; j < b->cols; ++j) {
+			value += rowB[j];
+		}
+		sums[i] = value;
+	}
+
+	job.lines = a->rows;
+	job.start = a->start;
+	job.index = a->index;
+	job.value = a->value;
+	job.fill = a->fill;
+	job.b = buffer;
+	job.ldb = bt.ld;
+	job.n = bt.cols;
+	job.sums = sums;
+	job.r = r;
+	parallel_for((a->rows + SPARSE_STRIP - 1) / SPARSE_STRIP,
+		_sparse_lines, &job);
+}
+
+/*
+	Function: sparse_multiply_tn
+	-----------------------------
+	Calculates transpose(B) A into an existing matrix R. Columns of A
+	combine rows of B into the rows of transpose(R), which is built in a
+	thread work buffer and transposed into R.
+
+	Parameters:
+	r - result, columns of B x columns of A
+	b - double matrix with the rows of A
+	a - sparse matrix
+*/
+void sparse_multiply_tn(Matrix *r, const Matrix *b, const Sparse *a)
+{
+	size_t size = (size_t)a->cols * b->cols;
+	double *buffer = (double*)pool_scratch(SCRATCH_SPARSE,
+		(size + b->cols) * sizeof(double));
+	Matrix rt = matrix_wrap(buffer, a->cols, b->cols);
+	double *sums = buffer + size;
+	Sparse_Job job;
+
+	memset(sums, 0, b->cols * sizeof(double));
+	for (int i = 0; i < b->rows; ++i) {
+		const double *rowB = MATRIX_ROW(*b, i);
+
+		for (int j = 0; j < b->cols; ++j) {
+			sums[j] += rowB[j];
+		}
+	}
+
+	job.lines = a->cols;
+	job.start = a->col_start;
+	job.index = a->row_index;
+	job.value = a->col_value;
+	job.fill = a->fill;
+	job.b = MATRIX_ROW(*b, 0);
+	job.ldb = b->ld;
+	job.n = b->cols;
+	job.sums = sums;
+	job.r = &rt;
+	parallel_for((a->cols + SPARSE_STRIP - 1) / SPARSE_STRIP,
+		_sparse_lines, &job);
+	matrix_transpose(r, &rt);
+}
+
+/*
+	Function: sparse_pattern
+	-------------------------
+	Describes other entries at the stored positions of A, with fill 0.
+	The descriptor shares the positions of A and does not own any
+	buffer, so it must not be released.
+
+	Parameters:
+	a - sparse matrix
+	value - entries in the order of a->value
+	col_value - the same entries in the order of a->col_value
+
+	Returns:
+	descriptor of the entries
+*/
+Sparse sparse_pattern(const Sparse *a, double *value, double *col_value)
+{
+	Sparse result = *a;
+
+	result.value = value;
+	result.col_value = col_value;
+	result.fill = 0;
+
+	return result;
+}
+
+/*
+	Function: sparse_predict
+	-------------------------
+	Calculates the entries of W H at the stored positions of A, each
+	one a dot product of a row of W with a row of transpose(H), which is
+	built in a thread work buffer. Entries are written in the order of
+	rows and again in the order of columns, so that both products with
+	the predictions walk contiguous entries. Costs O(nnz C).
+
+	Parameters:
+	p - pattern of a, see sparse_pattern(), receives the predictions
+	a - sparse matrix
+	w - users x groups matrix
+	h - groups x items matrix
+
+	Returns:
+	sum of squares of A - W H over the stored positions
+*/
+double sparse_predict(Sparse *p, const Sparse *a, const Matrix *w,
+	const Matrix *h)
+{
+	int strips = (a->rows + SPARSE_STRIP - 1) / SPARSE_STRIP;
+	size_t size = (size_t)h->cols * h->rows;
+	double *buffer = (double*)pool_scratch(SCRATCH_SPARSE,
+		(size + strips) * sizeof(double));
+	Matrix ht = matrix_wrap(buffer, h->cols, h->rows);
+	Predict_Job job;
+	double result = 0;
+
+	matrix_transpose(&ht, h);
+	job.a = a;
+	job.p = p;
+	job.w = w;
+	job.ht = &ht;
+	job.partial = buffer + size;
+	parallel_for(strips, _sparse_predict_rows, &job);
+	parallel_for((a->cols + SPARSE_STRIP - 1) / SPARSE_STRIP,
+		_sparse_predict_cols, &job);
+
+	// Strips are summed in order, so results do not depend on threads
+	for (int s = 0; s < strips; ++s) {
+		result += job.partial[s];
+	}
+
+	return result;
+}
+
+/*
+	Function: sparse_sub
+	---------------------
+	Calculates A - B into an existing matrix R. Every entry of B is read
+	before the same entry of R is written, so R may be B.
+
+	Parameters:
+	r - result
+	a - sparse matrix
+	b - double matrix of the same size
+*/
+void sparse_sub(Matrix *r, const Sparse *a, const Matrix *b)
+{
+	for (int i = 0; i < a->rows; ++i) {
+		const double *rowB = MATRIX_ROW(*b, i);
+		double *rowR = MATRIX_ROW(*r, i);
+		size_t p = a->start[i];
+
+		for (int j = 0; j < a->cols; ++j) {
+			if ((p < a->start[i + 1]) && (a->index[p] == j)) {
+				rowR[j] = a->value[p++] - rowB[j];
+			}
+			else {
+				rowR[j] = a->fill - rowB[j];
+			}
+		}
+	}
+}
+
+/*
+	Function: sparse_frobenius2
+	----------------------------
+	Calculates the sum of squares of all entries.
+
+	Parameters:
+	a - sparse matrix
+
+	Returns:
+	squared Frobenius norm
+*/
+double sparse_frobenius2(const Sparse *a)
+{
+	double result = a->fill * a->fill *
+		((double)a->rows * a->cols - (double)a->nnz);
+
+	for (int i = 0; i < a->rows; ++i) {
+		const double *row = a->value + a->start[i];
+		int count = (int)(a->start[i + 1] - a->start[i]);
+
+		result += simd.dot(row, row, count);
+	}
+
+	return result;
+}
+
+/*
+	Function: _sparse_alloc
+	------------------------
+	Internal function. Allocates a buffer of a sparse matrix.
+
+	Parameters:
+	size - size in bytes
+
+	Returns:
+	allocated buffer
+*/
+void *_sparse_alloc(size_t size)
+{
+	// Matrices without entries still get a buffer to release
+	void *result = buffer_alloc((size > 0) ? size : 1, false);
+
+	if (result == NULL) {
+		fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
+		getchar();
+		exit(1);
+	}
+
+	return result;
+}
+
+/*
+	Function: _sparse_transpose
+	----------------------------
+	Internal function. Compresses the entries of a compressed matrix by
+	its other dimension with a stable counting sort. Entries of every
+	result line come in the order of the source lines.
+
+	Parameters:
+	lines - number of source lines
+	width - length of source lines
+	start - start of every source line
+	index - positions of entries in their source lines
+	value - entries by source lines
+	t_start - start of every result line, width + 1 entries
+	t_index - source lines of entries
+	t_value - entries by result lines
+*/
+void _sparse_transpose(int lines, int width, const size_t *start,
+	const int *index, const double *value, size_t *t_start, int *t_index,
+	double *t_value)
+{
+	memset(t_start, 0, (width + 1) * sizeof(size_t));
+	for (size_t p = 0; p < start[lines]; ++p) {
+		++t_start[index[p] + 1];
+	}
+	for (int j = 0; j < width; ++j) {
+		t_start[j + 1] += t_start[j];
+	}
+
+	// Starts serve as insertion points, and are restored afterwards
+	for (int i = 0; i < lines; ++i) {
+		for (size_t p = start[i]; p < start[i + 1]; ++p) {
+			size_t q = t_start[index[p]]++;
+
+			t_index[q] = i;
+			t_value[q] = value[p];
+		}
+	}
+	for (int j = width; j > 0; --j) {
+		t_start[j] = t_start[j - 1];
+	}
+	t_start[0] = 0;
+}
+
+/*
+	Function: _sparse_dedup
+	------------------------
+	Internal function. Keeps the last of the entries of every position,
+	in rows sorted by columns, and compacts the rows.
+
+	Parameters:
+	a - sparse matrix with sorted rows
+*/
+void _sparse_dedup(Sparse *a)
+{
+	size_t q = 0;
+
+	for (int i = 0; i < a->rows; ++i) {
+		size_t p = a->start[i];
+		size_t end = a->start[i + 1];
+
+		a->start[i] = q;
+		for (; p < end; ++p) {
+			if ((q > a->start[i]) && (a->index[q - 1] == a->index[p])) {
+				a->value[q - 1] = a->value[p];
+			}
+			else {
+				a->index[q] = a->index[p];
+				a->value[q] = a->value[p];
+				++q;
+			}
+		}
+	}
+	a->start[a->rows] = q;
+	a->nnz = q;
+}
+
+/*
+	Function: _sparse_lines
+	------------------------
+	Internal function. Loop body of sparse products, calculates rows of
+	the result for strips of compressed lines from begin to end - 1.
+	Every row starts from fill times the sums of B, and every stored
+	entry x adds (x - fill) times its row of B.
+
+	Parameters:
+	arg - sparse product job
+	begin - first strip
+	end - strip after the last one
+*/
+void _sparse_lines(void *arg, int begin, int end)
+{
+	const Sparse_Job *job = (const Sparse_Job*)arg;
+	int last = end * SPARSE_STRIP;
+
+	if (last > job->lines) {
+		last = job->lines;
+	}
+	for (int i = begin * SPARSE_STRIP; i < last; ++i) {
+		double *row = MATRIX_ROW(*job->r, i);
+		size_t p = job->start[i];
+
+		for (int j = 0; j < job->n; ++j) {
+			row[j] = job->fill * job->sums[j];
+		}
+		simd.gather(row, job->value + p, job->index + p, job->b, job->ldb,
+			(int)(job->start[i + 1] - p), job->n, job->fill);
+	}
+}
+
+/*
+	Function: _sparse_predict_rows
+	-------------------------------
+	Internal function. Loop body of sparse_predict(), writes predictions
+	in the order of rows for strips of rows from begin to end - 1, and
+	the squared residuals of every strip.
+
+	Parameters:
+	arg - prediction job
+	begin - first strip
+	end - strip after the last one
+*/
+void _sparse_predict_rows(void *arg, int begin, int end)
+{
+	const Predict_Job *job = (const Predict_Job*)arg;
+	const Sparse *a = job->a;
+
+	for (int s = begin; s < end; ++s) {
+		int last = (s + 1) * SPARSE_STRIP;
+		double sum = 0;
+
+		if (last > a->rows) {
+			last = a->rows;
+		}
+		for (int i = s * SPARSE_STRIP; i < last; ++i) {
+			const double *rowW = MATRIX_ROW(*job->w, i);
+
+			for (size_t q = a->start[i]; q < a->start[i + 1]; ++q) {
+				double x = simd.dot(rowW, MATRIX_ROW(*job->ht, a->index[q]),
+					job->w->cols);
+
+				job->p->value[q] = x;
+				sum += (a->value[q] - x) * (a->value[q] - x);
+			}
+		}
+		job->partial[s] = sum;
+	}
+}
+
+/*
+	Function: _sparse_predict_cols
+	-------------------------------
+	Internal function. Loop body of sparse_predict(), writes predictions
+	in the order of columns for strips of columns from begin to end - 1.
+
+	Parameters:
+	arg - prediction job
+	begin - first strip
+	end - strip after the last one
+*/
+void _sparse_predict_cols(void *arg, int begin, int end)
+{
+	const Predict_Job *job = (const Predict_Job*)arg;
+	const Sparse *a = job->a;
+	int last = end * SPARSE_STRIP;
+
+	if (last > a->cols) {
+		last = a->cols;
+	}
+	for (int j = begin * SPARSE_STRIP; j < last; ++j) {
+		const double *rowH = MATRIX_ROW(*job->ht, j);
+
+		for (size_t q = a->col_start[j]; q < a->col_start[j + 1]; ++q) {
+			// Same operands as the row order, so both orders agree
+			job->p->col_value[q] = simd.dot(
+				MATRIX_ROW(*job->w, a->row_index[q]), rowH, job->w->cols);
+		}
+	}
+}
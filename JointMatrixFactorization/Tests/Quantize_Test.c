@@ -0,0 +1,115 @@
+/*
+ * Round trip test of quantized rating storage. It is not part of the
+ * project, build it with every source file but Main.c and the file
+ * reading ones, e.g. from this folder:
+ *   gcc -std=gnu99 -I.. Quantize_Test.c ../Matrix.c ../Matrix_Fact.c
+ *   ../Utility.c ../Gemm.c ../Simd.c ../Kernels.c ../Sparse.c
+ *   ../Thread_Pool.c ../Allocator.c -lm -lpthread
+ */
+
+#include "matrix.h"
+#include "simd.h"
+#include "threadpool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#define TEST_COLS 11	// Longer than one vector of decode kernels
+
+int _round_trip(Matrix_Type, const char*);
+int _grid_ends(Matrix_Type, const char*);
+
+int main()
+{
+	int failures = 0;
+
+	simd_initialize();
+	pool_initialize(0);
+
+	failures += _round_trip(MATRIX_U8, "u8");
+	failures += _round_trip(MATRIX_U16, "u16");
+	failures += _grid_ends(MATRIX_U8, "u8");
+	failures += _grid_ends(MATRIX_U16, "u16");
+
+	pool_shutdown();
+	printf("%s\n", (failures == 0) ? "All tests passed." : "Tests failed!");
+	return (failures == 0) ? 0 : 1;
+}
+
+/*
+	Function: _round_trip
+	----------------------
+	Internal function. Stores ratings 1 to 5 and the fill of unrated
+	entries, the way file_to_matrix() does, and checks that every
+	entry reads back exactly through MATRIX_GET() and matrix_read().
+
+	Parameters:
+	type - quantized storage type
+	name - name of the type in messages
+
+	Returns:
+	number of failed checks
+*/
+int _round_trip(Matrix_Type type, const char *name)
+{
+	double min = 1;
+	double max = 5;
+	double fill = -min / (max - min);
+	double expect[TEST_COLS];
+	double buffer[TEST_COLS];
+	const double *row;
+	int failures = 0;
+	Matrix a = matrix_typed(1, TEST_COLS, type);
+
+	matrix_set_range(&a, fill, min, max, true);
+	for (int j = 0; j < TEST_COLS; ++j) {
+		// Every third entry is unrated
+		expect[j] = (j % 3 == 2) ? fill : 1 + j % 5;
+		MATRIX_SET(a, 0, j, expect[j]);
+	}
+
+	row = matrix_read(&a, 0, 0, TEST_COLS, buffer);
+	for (int j = 0; j < TEST_COLS; ++j) {
+		if ((MATRIX_GET(a, 0, j) != expect[j]) || (row[j] != expect[j])) {
+			printf("%s: entry %d reads %.17g and %.17g, expected %g\n",
+				name, j, MATRIX_GET(a, 0, j), row[j], expect[j]);
+			++failures;
+		}
+	}
+
+	matrix_free(&a);
+	return failures;
+}
+
+/*
+	Function: _grid_ends
+	---------------------
+	Internal function. Checks that ratings which are not integers still
+	keep their minimum, maximum and fill exactly.
+
+	Parameters:
+	type - quantized storage type
+	name - name of the type in messages
+
+	Returns:
+	number of failed checks
+*/
+int _grid_ends(Matrix_Type type, const char *name)
+{
+	double expect[3] = { -0.25, 0.5, 4.5 };
+	int failures = 0;
+	Matrix a = matrix_typed(1, 3, type);
+
+	matrix_set_range(&a, expect[0], expect[1], expect[2], false);
+	for (int j = 0; j < 3; ++j) {
+		MATRIX_SET(a, 0, j, expect[j]);
+		if (MATRIX_GET(a, 0, j) != expect[j]) {
+			printf("%s: grid entry %d reads %.17g, expected %g\n",
+				name, j, MATRIX_GET(a, 0, j), expect[j]);
+			++failures;
+		}
+	}
+
+	matrix_free(&a);
+	return failures;
+}
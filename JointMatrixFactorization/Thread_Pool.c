@@ -0,0 +1,427 @@
+#include "threadpool.h"
+#include "allocator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#ifdef _WIN32
+#include <windows.h>
+
+typedef CRITICAL_SECTION Pool_Lock;
+typedef CONDITION_VARIABLE Pool_Cond;
+typedef HANDLE Pool_Thread;
+#define POOL_LOCK(l) EnterCriticalSection(&(l))
+#define POOL_UNLOCK(l) LeaveCriticalSection(&(l))
+#define POOL_WAIT(c, l) SleepConditionVariableCS(&(c), &(l), INFINITE)
+#define POOL_SIGNAL(c) WakeConditionVariable(&(c))
+#define POOL_BROADCAST(c) WakeAllConditionVariable(&(c))
+#define POOL_LOCAL __declspec(thread)
+#else
+#include <pthread.h>
+#include <unistd.h>
+
+typedef pthread_mutex_t Pool_Lock;
+typedef pthread_cond_t Pool_Cond;
+typedef pthread_t Pool_Thread;
+#define POOL_LOCK(l) pthread_mutex_lock(&(l))
+#define POOL_UNLOCK(l) pthread_mutex_unlock(&(l))
+#define POOL_WAIT(c, l) pthread_cond_wait(&(c), &(l))
+#define POOL_SIGNAL(c) pthread_cond_signal(&(c))
+#define POOL_BROADCAST(c) pthread_cond_broadcast(&(c))
+#define POOL_LOCAL __thread
+#endif
+
+typedef struct Thread_Pool
+{
+	bool ready;		// Whether locks are initialized
+	int threads;	// Threads running loops, including the caller
+	int workers;	// Started worker threads
+	Pool_Thread *handles;
+	Pool_Lock lock;
+	Pool_Cond wake;	// Signals workers about a new loop or stop
+	Pool_Cond done;	// Signals the caller that workers finished
+	bool stop;
+	bool busy;		// Whether a loop is running
+	unsigned long job;	// Number of started loops
+	unsigned long base;	// Number of loops started before workers
+	int pending;	// Workers still running current loop
+	// Current loop
+	Task_Func func;
+	void *arg;
+	int count;
+	int next;		// Next task to take
+	// State shared by tasks, see pool_lock()
+	Pool_Lock shared;
+	Pool_Cond changed;	// Signals tasks waiting for shared state
+} Thread_Pool;
+
+// Work buffer of one slot of a thread
+typedef struct Pool_Scratch
+{
+	void *buffer;
+	size_t size;	// Capacity in bytes
+} Pool_Scratch;
+
+// Fields not named start zero, locks are initialized by pool_initialize()
+Thread_Pool pool = { .ready = false, .threads = 1 };
+// Work buffers of the current thread
+POOL_LOCAL Pool_Scratch scratch[SCRATCH_COUNT];
+
+int _pool_processors();
+void _pool_run();
+void _pool_worker();
+void _pool_release();
+#ifdef _WIN32
+DWORD WINAPI _pool_entry(LPVOID);
+#else
+void *_pool_entry(void*);
+#endif
+
+/*
+	Function: pool_initialize
+	--------------------------
+	Starts worker threads. Running workers are stopped first, so that
+	the function can be called again to change thread number.
+
+	Parameters:
+	threads - number of threads running parallel loops, including the
+		calling thread. 0 uses one thread per processor.
+*/
+void pool_initialize(int threads)
+{
+	if (!pool.ready) {
+#ifdef _WIN32
+		InitializeCriticalSection(&pool.lock);
+		InitializeConditionVariable(&pool.wake);
+		InitializeConditionVariable(&pool.done);
+#else
+		pthread_mutex_init(&pool.lock, NULL);
+		pthread_cond_init(&pool.wake, NULL);
+		pthread_cond_init(&pool.done, NULL);
+#endif
+#ifdef _WIN32
+		InitializeCriticalSection(&pool.shared);
+		InitializeConditionVariable(&pool.changed);
+#else
+		pthread_mutex_init(&pool.shared, NULL);
+		pthread_cond_init(&pool.changed, NULL);
+#endif
+		pool.ready = true;
+	}
+	pool_shutdown();
+
+	if (threads <= 0) {
+		threads = _pool_processors();
+	}
+	pool.threads = threads;
+	pool.base = pool.job;
+	if (threads == 1) {
+		return;
+	}
+
+	pool.handles = (Pool_Thread*)malloc((threads - 1) * sizeof(Pool_Thread));
+	if (pool.handles == NULL) {
+		fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
+		getchar();
+		exit(1);
+	}
+	for (int i = 0; i < threads - 1; ++i) {
+#ifdef _WIN32
+		pool.handles[i] = CreateThread(NULL, 0, _pool_entry, NULL, 0, NULL);
+		if (pool.handles[i] == NULL) {
+			break;
+		}
+#else
+		if (pthread_create(&pool.handles[i], NULL, _pool_entry, NULL) != 0) {
+			break;
+		}
+#endif
+		++pool.workers;
+	}
+	// Runs with fewer threads when system refuses more
+	pool.threads = pool.workers + 1;
+}
+
+/*
+	Function: pool_threads
+	-----------------------
+	Returns: number of threads running parallel loops, including the
+		calling thread.
+*/
+int pool_threads()
+{
+	return pool.threads;
+}
+
+/*
+	Function: parallel_for
+	-----------------------
+	Runs tasks 0 to count - 1 on the pool. Idle threads take one task at
+	a time, so tasks should be coarse. The call returns after all tasks
+	finished. A loop started while another loop is running, e.g. from
+	inside a task, runs on the calling thread only.
+
+	Parameters:
+	count - number of tasks
+	func - loop body
+	arg - argument passed to loop body
+*/
+void parallel_for(int count, Task_Func func, void *arg)
+{
+	if (count <= 0) {
+		return;
+	}
+	if ((pool.workers == 0) || (count == 1)) {
+		func(arg, 0, count);
+		return;
+	}
+
+	POOL_LOCK(pool.lock);
+	if (pool.busy) {
+		POOL_UNLOCK(pool.lock);
+		func(arg, 0, count);
+		return;
+	}
+	pool.busy = true;
+	pool.func = func;
+	pool.arg = arg;
+	pool.count = count;
+	pool.next = 0;
+	pool.pending = pool.workers;
+	++pool.job;
+	POOL_BROADCAST(pool.wake);
+	POOL_UNLOCK(pool.lock);
+
+	_pool_run();
+
+	POOL_LOCK(pool.lock);
+	while (pool.pending > 0) {
+		POOL_WAIT(pool.done, pool.lock);
+	}
+	pool.busy = false;
+	POOL_UNLOCK(pool.lock);
+}
+
+/*
+	Function: pool_scratch
+	-----------------------
+	Returns a work buffer of the calling thread. Every thread keeps one
+	buffer per slot, which only grows, so kernels running every
+	iteration of the solver stop allocating once the largest size was
+	seen. Contents are not kept when the buffer grows. Buffers of workers
+	are freed when they stop, those of the calling thread by
+	pool_shutdown().
+
+	Parameters:
+	slot - buffer of the thread
+	size - size in bytes
+
+	Returns:
+	buffer of at least size bytes
+*/
+void *pool_scratch(Scratch_Slot slot, size_t size)
+{
+	Pool_Scratch *s = &scratch[slot];
+
+	if ((s->buffer == NULL) || (s->size < size)) {
+		buffer_free(s->buffer);
+		s->size = (size > 0) ? size : 1;
+		s->buffer = buffer_alloc(s->size, false);
+		if (s->buffer == NULL) {
+			fprintf(stderr, "Fatal Error: Program runs out of memory!\n");
+			getchar();
+			exit(1);
+		}
+	}
+
+	return s->buffer;
+}
+
+/*
+	Function: pool_lock
+	--------------------
+	Locks state shared by the tasks of a parallel loop. Before the pool
+	is initialized loops run on one thread, and locks do nothing.
+*/
+void pool_lock()
+{
+	if (pool.ready) {
+		POOL_LOCK(pool.shared);
+	}
+}
+
+/*
+	Function: pool_unlock
+	----------------------
+	Unlocks state shared by the tasks of a parallel loop.
+*/
+void pool_unlock()
+{
+	if (pool.ready) {
+		POOL_UNLOCK(pool.shared);
+	}
+}
+
+/*
+	Function: pool_wait
+	--------------------
+	Waits with the lock of pool_lock() held until another task calls
+	pool_notify(). The lock is released while waiting and held again on
+	return. Wakeups may be spurious, so callers check their condition
+	again.
+*/
+void pool_wait()
+{
+	if (pool.ready) {
+		POOL_WAIT(pool.changed, pool.shared);
+	}
+}
+
+/*
+	Function: pool_notify
+	----------------------
+	Wakes all tasks waiting in pool_wait().
+*/
+void pool_notify()
+{
+	if (pool.ready) {
+		POOL_BROADCAST(pool.changed);
+	}
+}
+
+/*
+	Function: pool_shutdown
+	------------------------
+	Stops and joins all worker threads. Parallel loops run on the
+	calling thread afterwards. Work buffers of the calling thread are
+	freed as well.
+*/
+void pool_shutdown()
+{
+	_pool_release();
+	if (!pool.ready || (pool.workers == 0)) {
+		pool.threads = 1;
+		return;
+	}
+
+	POOL_LOCK(pool.lock);
+	pool.stop = true;
+	POOL_BROADCAST(pool.wake);
+	POOL_UNLOCK(pool.lock);
+
+	for (int i = 0; i < pool.workers; ++i) {
+#ifdef _WIN32
+		WaitForSingleObject(pool.handles[i], INFINITE);
+		CloseHandle(pool.handles[i]);
+#else
+		pthread_join(pool.handles[i], NULL);
+#endif
+	}
+	free(pool.handles);
+	pool.handles = NULL;
+	pool.workers = 0;
+	pool.threads = 1;
+	pool.stop = false;
+}
+
+/*
+	Function: _pool_processors
+	---------------------------
+	Internal function.
+
+	Returns: number of online processors.
+*/
+int _pool_processors()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n > 0) ? (int)n : 1;
+#endif
+}
+
+/*
+	Function: _pool_run
+	--------------------
+	Internal function. Takes tasks of current loop until none is left.
+*/
+void _pool_run()
+{
+	for (;;) {
+		int task;
+
+		POOL_LOCK(pool.lock);
+		task = pool.next++;
+		POOL_UNLOCK(pool.lock);
+
+		if (task >= pool.count) {
+			return;
+		}
+		pool.func(pool.arg, task, task + 1);
+	}
+}
+
+/*
+	Function: _pool_release
+	------------------------
+	Internal function. Frees work buffers of the calling thread.
+*/
+void _pool_release()
+{
+	for (int i = 0; i < SCRATCH_COUNT; ++i) {
+		buffer_free(scratch[i].buffer);
+		scratch[i].buffer = NULL;
+		scratch[i].size = 0;
+	}
+}
+
+/*
+	Function: _pool_worker
+	-----------------------
+	Internal function. Main loop of a worker thread. Waits for a new
+	loop, works on it and reports back, until the pool stops.
+*/
+void _pool_worker()
+{
+	unsigned long seen = pool.base;
+
+	POOL_LOCK(pool.lock);
+	for (;;) {
+		while (!pool.stop && (pool.job == seen)) {
+			POOL_WAIT(pool.wake, pool.lock);
+		}
+		if (pool.stop) {
+			break;
+		}
+		seen = pool.job;
+		POOL_UNLOCK(pool.lock);
+
+		_pool_run();
+
+		POOL_LOCK(pool.lock);
+		if (--pool.pending == 0) {
+			POOL_SIGNAL(pool.done);
+		}
+	}
+	POOL_UNLOCK(pool.lock);
+	_pool_release();
+}
+
+#ifdef _WIN32
+DWORD WINAPI _pool_entry(LPVOID arg)
+{
+	(void)arg;
+	_pool_worker();
+	return 0;
+}
+#else
+void *_pool_entry(void *arg)
+{
+	(void)arg;
+	_pool_worker();
+	return NULL;
+}
+#endif
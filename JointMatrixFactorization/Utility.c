@@ -1,6 +1,9 @@
 #include "utility.h"
+#include "algorithms.h"
 #include "itemproc.h"
 #include "matrix.h"
+#include "simd.h"
+#include "kernels.h"
 #include <stdlib.h>
 #include <string.h>
 #include <malloc.h>
@@ -86,7 +89,8 @@ double find_number(char *str)
 {
 	bool hasDecimal = false;
 	int index = 0;
-	char num[20];
+	// Zero filled, so that digits up to the end of str stay terminated
+	char num[20] = { 0 };
 
 	// Finds a valid number string
 	for (int i = 0; i < (int) strlen(str); ++i) {
@@ -129,32 +133,37 @@ double find_number(char *str)
 /*
 	Function: vector_dist
 	----------------------
-	Internal function. Finds distance between same item columns in two
-	different soruces.
+	Internal function. Finds distances between same item columns in two
+	different soruces. All item columns are processed together, so that
+	the distances are accumulated along contiguous rows of H. Common
+	group numbers sum all rows of H in registers, see kernels.h.
 
 	Parameters:
 	src - source structure
 	a - index of the first source
 	b - index of the second source
-	size - size of sources
-	k - index of item column
-
-	Returns:
-	euclidean distance. Otherwise, -1 if index is out of source boundary
+	dist - euclidean distance of every item column
 */
-double vector_dist(Source *src, int a, int b, int size, int k)
+void vector_dist(Source *src, int a, int b, double *dist)
 {
-	double result = -1.0;
+	const Group_Kernels *group = group_kernels(src->C);
 
-	if ((a < size) && (b < size)) {
-		result = 0;
+	for (int k = 0; k < src->K; ++k) {
+		dist[k] = 0;
+	}
+	if (group != NULL) {
+		group->sqdiff_rows(dist, MATRIX_ROW(src[b].H, 0), src[b].H.ld,
+			MATRIX_ROW(src[a].H, 0), src[a].H.ld, src->K);
+	}
+	else {
 		for (int i = 0; i < src->C; ++i) {
-			result += pow(src[b].H[i][k] - src[a].H[i][k], 2.0);
+			simd.sqdiff_acc(dist, MATRIX_ROW(src[b].H, i),
+				MATRIX_ROW(src[a].H, i), src->K);
 		}
-		result = sqrt(result);
 	}
-	
-	return result;
+	for (int k = 0; k < src->K; ++k) {
+		dist[k] = sqrt(dist[k]);
+	}
 }
 
 /*
@@ -171,25 +180,30 @@ double vector_dist(Source *src, int a, int b, int size, int k)
  */
 double** get_reliable(Source *src, int size)
 {
-	double temp = -1.0;
 	double min = -1.0;
 	double max = -1.0;
-	double comp;
 	double **result = (double**)malloc(size * sizeof(double*));
+	double *comp = (double*)malloc(src->K * sizeof(double));
 
 	for (int i = 0; i < size; ++i) {
+		// Finds minimum distance to other sources of each item first
 		result[i] = (double*)malloc(src->K * sizeof(double));
 		for (int k = 0; k < src->K; ++k) {
-			for (int j = 0; j < size; ++j) {
-				if (i != j) {
-					comp = vector_dist(src, i, j, size, k);
-					if ((temp > comp) || (temp < 0)) {
-						temp = comp;
+			result[i][k] = -1.0;
+		}
+		for (int j = 0; j < size; ++j) {
+			if (i != j) {
+				vector_dist(src, i, j, comp);
+				for (int k = 0; k < src->K; ++k) {
+					if ((result[i][k] > comp[k]) || (result[i][k] < 0)) {
+						result[i][k] = comp[k];
 					}
 				}
 			}
-			result[i][k] = 1.0 / temp;
-			temp = -1;
+		}
+
+		for (int k = 0; k < src->K; ++k) {
+			result[i][k] = 1.0 / result[i][k];
 			if ((max == -1) || max < result[i][k]) {
 				max = result[i][k];
 			}
@@ -198,6 +212,7 @@ double** get_reliable(Source *src, int size)
 			}
 		}
 	}
+	free(comp);
 
 	// Normalization
 	if (max != min) {
@@ -225,99 +240,69 @@ double** get_reliable(Source *src, int size)
 
 	Parameter:
 	src - source structure
+	storage - storage type of ratings, quantized ratings get their range
+		in file_to_matrix()
+	sparse - whether ratings are stored sparse, V stays empty then
  */
-void inputs_initialize(Source *src)
+void inputs_initialize(Source *src, Matrix_Type storage, bool sparse)
 {
 	src->K = src->items->length;	// Adjust item number
-	double *temp = (double*)malloc(src->N * src->K * sizeof(double));
-	if (temp == NULL) {
-		fprintf(stderr, "Fatal Error: Program ran out of memory!\n");
-		exit(1);
-	}
-	src->V = (double**)malloc(src->N * sizeof(double*));
-	if (src->V == NULL) {
-		fprintf(stderr, "Fatal Error: Program ran out of memory!\n");
-		exit(1);
+	src->sparse = sparse;
+	if (sparse) {
+		src->V = matrix_wrap(NULL, 0, 0);
+		src->R = sparse_new(src->N, src->K);
 	}
-
-	for (int i = 0; i < src->N; ++i) {
-		for (int j = 0; j < src->K; ++j) {
-			temp[i * src->K + j] = 0;
-		}
-		src->V[i] = &temp[i * src->K];
+	else {
+		src->V = matrix_typed(src->N, src->K, storage);
 	}
 
 	src->min = -1;
 	src->max = -1;
-	src->W = NULL;
-	src->H = NULL;
+	src->W.data = NULL;
+	src->H.data = NULL;
 }
 
 /*
 	Function: joints_initialize
 	---------------------------
-	Initializes matrices of factorized matrices this source.
+	Initializes matrices of factorized matrices this source, and the
+	workspace of matrix_factorization() sized for them.
  
 	Parameter:
 	src - the object source to be initialized
 	size - size of sources
 	val_c - group number
+	work - workspace to be allocated
  */
-void joints_initialize(Source *src, int size, int val_c)
+void joints_initialize(Source *src, int size, int val_c, Arena *work)
 {
-	double *temp;
 	for (int i = 0; i < size; ++i) {
 		src[i].C = val_c;
-		temp = (double*)malloc(src[i].N * val_c * sizeof(double));
-		if (temp == NULL) {
-			fprintf(stderr, "Fatal Error: Program ran out of memory!\n");
-			exit(1);
-		}
-		src[i].W = (double**)malloc(src[i].N * sizeof(double*));
-		if (src[i].W == NULL) {
-			fprintf(stderr, "Fatal Error: Program ran out of memory!\n");
-			exit(1);
-		}
-		for (int j = 0; j < src[i].N; ++j) {
-			src[i].W[j] = &temp[j * val_c];
-		}
-		temp = (double*)malloc(val_c * src[i].K * sizeof(double));
-		if (temp == NULL) {
-			fprintf(stderr, "Fatal Error: Program ran out of memory!\n");
-			exit(1);
-		}
-		src[i].H = (double**)malloc(val_c * sizeof(double*));
-		if (src[i].H == NULL) {
-			fprintf(stderr, "Fatal Error: Program ran out of memory!\n");
-			exit(1);
-		}
-		for (int j = 0; j < val_c; ++j) {
-			src[i].H[j] = &temp[j * src[i].K];
-		}
+		src[i].W = matrix_new(src[i].N, val_c);
+		src[i].H = matrix_new(val_c, src[i].K);
 	}
+	*work = arena_new(factorization_space(src, size));
 }
 
 /*
 	Function: joint_clear
 	----------------------
-	Clears joint matrices.
+	Clears joint matrices and the workspace.
 
 	Parameters:
 	src - source structure
 	size - size of sources
+	work - workspace of joints_initialize()
  */
-void joint_clear(Source *src, int size)
+void joint_clear(Source *src, int size, Arena *work)
 {
+	arena_free(work);
 	for (int i = 0; i < size; ++i) {
-		if (src[i].W != NULL) {
-			free(src[i].W[0]);
-			free(src[i].W);
-			src[i].W = NULL;
+		if (src[i].W.data != NULL) {
+			matrix_free(&src[i].W);
 		}
-		if (src[i].H != NULL) {
-			free(src[i].H[0]);
-			free(src[i].H);
-			src[i].H = NULL;
+		if (src[i].H.data != NULL) {
+			matrix_free(&src[i].H);
 		}
 		src[i].C = 0;
 	}
@@ -353,15 +338,15 @@ void clear2D(double ***ptr, int r)
 void reset(Source *src, int size)
 {
 	for (int i = 0; i < size; ++i) {
-		free(src[i].V[0]);
-		free(src[i].V);
-		if (src[i].W != NULL) {
-			free(src[i].W[0]);
-			free(src[i].W);
+		matrix_free(&src[i].V);
+		if (src[i].sparse) {
+			sparse_free(&src[i].R);
+		}
+		if (src[i].W.data != NULL) {
+			matrix_free(&src[i].W);
 		}
-		if (src[i].H != NULL) {
-			free(src[i].H[0]);
-			free(src[i].H);
+		if (src[i].H.data != NULL) {
+			matrix_free(&src[i].H);
 		}
 		for (int j = 0; j < src[i].K; ++j) {
 			free(src[i].items[j].name);
@@ -369,4 +354,98 @@ void reset(Source *src, int size)
 		free(src[i].items);
 	}
 	free(src);
-}
\ No newline at end of file
+}
+
+/*
+	Function: read_options
+	-----------------------
+	Reads solver options from a string of "name=value" settings.
+	Settings that are not given keep their default values.
+
+	Parameters:
+	str - the string to be read
+	opt - read options
+ */
+void read_options(char *str, Options *opt)
+{
+	char *ptr;
+
+	opt->threads = 0;
+	opt->strassen = STRASSEN_DIM;
+	opt->precision = PRECISION_DOUBLE;
+	opt->cost = COST_FROBENIUS;
+	opt->objective = OBJECTIVE_FULL;
+	opt->solver = SOLVER_SEQUENTIAL;
+	opt->staleness = 2;
+
+	if ((ptr = strstr(str, "threads=")) != NULL) {
+		opt->threads = strtol(ptr + strlen("threads="), NULL, 10);
+	}
+	if ((ptr = strstr(str, "strassen=")) != NULL) {
+		opt->strassen = strtol(ptr + strlen("strassen="), NULL, 10);
+	}
+	if ((ptr = strstr(str, "ratings=")) != NULL) {
+		ptr += strlen("ratings=");
+		if (strncmp(ptr, "float", strlen("float")) == 0) {
+			opt->precision = PRECISION_MIXED;
+		}
+	}
+	if ((ptr = strstr(str, "cost=")) != NULL) {
+		ptr += strlen("cost=");
+		if (strncmp(ptr, "spectral", strlen("spectral")) == 0) {
+			opt->cost = COST_SPECTRAL;
+		}
+	}
+	if ((ptr = strstr(str, "objective=")) != NULL) {
+		ptr += strlen("objective=");
+		if (strncmp(ptr, "masked", strlen("masked")) == 0) {
+			opt->objective = OBJECTIVE_MASKED;
+		}
+	}
+	if ((ptr = strstr(str, "solver=")) != NULL) {
+		ptr += strlen("solver=");
+		if (strncmp(ptr, "sources", strlen("sources")) == 0) {
+			opt->solver = SOLVER_SOURCES;
+		}
+		else if (strncmp(ptr, "async", strlen("async")) == 0) {
+			opt->solver = SOLVER_ASYNC;
+		}
+	}
+	if ((ptr = strstr(str, "staleness=")) != NULL) {
+		opt->staleness = strtol(ptr + strlen("staleness="), NULL, 10);
+		if (opt->staleness < 0) {
+			opt->staleness = 0;
+		}
+	}
+}
+
+/*
+	Function: read_storage
+	-----------------------
+	Reads the storage type of ratings. 8-bit and 16-bit codes take 1/8
+	and 1/4 of the memory of doubles. Integer ratings spanning up to
+	255 or 65535 levels are stored exactly, others are rounded to that
+	many evenly spaced levels. Sparse storage keeps rated
+	entries only, as doubles, so its memory and products scale with the
+	number of ratings.
+
+	Parameters:
+	str - the string to be read, "u8", "u16", "sparse" or anything else
+		for double
+	sparse - set when ratings are stored sparse
+
+	Returns:
+	storage type of dense ratings
+ */
+Matrix_Type read_storage(char *str, bool *sparse)
+{
+	*sparse = (strstr(str, "sparse") != NULL);
+	if (strstr(str, "u8") != NULL) {
+		return MATRIX_U8;
+	}
+	if (strstr(str, "u16") != NULL) {
+		return MATRIX_U16;
+	}
+
+	return MATRIX_F64;
+}
@@ -4,6 +4,17 @@
 #include "utility.h"
 #include "matrix.h"
 
-void matrix_factorization(Source *src, int size, double alpha);
+// Norm of the cost of the current run
+extern Cost_Norm cost_norm;
+// Entries of V fitted by the current run
+extern Objective objective;
+// Scheduling of sources of the current run
+extern Solver_Mode solver_mode;
+// Iterations a source may run ahead of the slowest one, see SOLVER_ASYNC
+extern int solver_staleness;
+
+// Size in doubles of the workspace of matrix_factorization()
+size_t factorization_space(const Source *src, int size);
+void matrix_factorization(Source *src, int size, double alpha, Arena *work);
 
 #endif
\ No newline at end of file
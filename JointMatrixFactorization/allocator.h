@@ -0,0 +1,24 @@
+#ifndef ALLOCATOR_H_
+#define ALLOCATOR_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * This header contains the allocator of matrix buffers. Buffers start
+ * on a cache line, so that vector loads of row starts never split
+ * lines. Large buffers are backed by huge pages where the system
+ * provides them, which saves TLB misses on long scans of V.
+ */
+
+#define ALLOC_ALIGN 64	// Alignment of buffers in bytes, one cache line
+#define ALLOC_HUGE_PAGE (2 * 1024 * 1024)	// Size of a huge page
+// Bytes from which buffers are backed by huge pages
+#define ALLOC_HUGE_MIN (4 * 1024 * 1024)
+
+// Allocates an aligned buffer, filled with zeros if zero is set
+void *buffer_alloc(size_t size, bool zero);
+// Releases a buffer of buffer_alloc(), NULL is ignored
+void buffer_free(void *buffer);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef GEMM_H_
+#define GEMM_H_
+
+#include "matrix.h"
+
+/*
+ * This header contains the blocked matrix multiplication engine.
+ * Operands are packed into contiguous panels sized for the caches and
+ * multiplied by a register tiled micro-kernel.
+ */
+
+#define GEMM_MR 4	// Rows of a register tile
+#define GEMM_NR 8	// Columns of a register tile
+#define GEMM_KC 256	// Depth of packed panels, keeps a B micro-panel in L1
+#define GEMM_MC 128	// Rows of a packed A block, kept in L2
+#define GEMM_NC 4096	// Columns of a packed B panel, kept in L3
+#define GEMM_ROWS_KB 64	// Rows of B combined at once by gemm_rows()
+#define GEMM_ROWS_NB 512	// Columns of B combined at once by gemm_rows()
+#define SYRK_NB 256	// Block rows of large syrk() products
+#define SYRK_SMALL 64	// Largest size of a small syrk() product
+#define SYRK_KB 4096	// Rows of A summed into one partial triangle
+#define SYRK_BATCH_MAX 8	// Largest size of interleaved syrk_batch() products
+#define SYRK_BATCH_KB 64	// Columns of op(A) interleaved at once
+#define GEMM_PARALLEL_MIN 1e6	// Multiply-adds worth running in parallel
+#define GEMM_TILES_PER_THREAD 4	// Tiles per thread, balances uneven tiles
+
+// Calculates C = op(A)op(B) + beta * C, op() transposes flagged operands
+void gemm(bool transA, bool transB, const Matrix *a, const Matrix *b,
+	double beta, Matrix *c);
+// Calculates C = op(A)B + beta * C by combining rows of B
+void gemm_rows(bool transA, const Matrix *a, const Matrix *b, double beta,
+	Matrix *c);
+// Calculates C = A transpose(B) + beta * C by dot products of rows
+void gemm_dots(const Matrix *a, const Matrix *b, double beta, Matrix *c);
+// Calculates C[i] = op(A[i])op(B[i]) + beta * C[i] for count products
+// of one shape, with the kernels of path
+void gemm_batch(Multiply_Path path, bool transA, bool transB, int count,
+	const Matrix *a, const Matrix *b, double beta, Matrix *c);
+// Calculates the lower triangle of C = op(A) transpose(op(A))
+void syrk(bool trans, const Matrix *a, Matrix *c);
+// Calculates lower triangles of C[i] = op(A[i]) transpose(op(A[i])) for
+// count products of one size
+void syrk_batch(bool trans, int count, const Matrix *a, Matrix *c);
+
+#endif
@@ -0,0 +1,154 @@
+/*
+ * Body of the kernels in kernels.h. This file has no include guard: it
+ * is included by Kernels.c once per instruction set and group number,
+ * with these macros defined beforehand:
+ *
+ * GK_C - group number
+ * GK_NAME(f) - name of kernel f for this instruction set and GK_C
+ * GK_ATTR - attribute enabling the instruction set
+ * VEC, VEC_W - vector type and its number of doubles
+ * V_ZERO(), V_SET1(x), V_LOAD(p), V_STORE(p, x) - vector creation and
+ *	unaligned memory access
+ * V_ADD, V_SUB, V_MUL, V_DIV, V_FMA(a, b, c), V_SQRT, V_SUM(x) -
+ *	arithmetic, V_FMA is a * b + c and V_SUM adds all elements
+ * V_POS(x), V_NEG(x) - positive and negative parts of a vector
+ */
+
+// Rows of B whose dot products are accumulated together
+#if GK_C < 8
+#define GK_DOTS GK_C
+#else
+#define GK_DOTS 8
+#endif
+
+GK_ATTR void GK_NAME(combine)(double *c, const double *coef,
+	const double *b, size_t ldb, int n, double beta)
+{
+	VEC x[GK_C];
+	int j = 0;
+
+	SIMD_UNROLL
+	for (int p = 0; p < GK_C; ++p) {
+		x[p] = V_SET1(coef[p]);
+	}
+	for (; j + 2 * VEC_W <= n; j += 2 * VEC_W) {
+		VEC c0 = V_ZERO();
+		VEC c1 = V_ZERO();
+
+		if (beta != 0) {
+			c0 = V_MUL(V_SET1(beta), V_LOAD(c + j));
+			c1 = V_MUL(V_SET1(beta), V_LOAD(c + j + VEC_W));
+		}
+		SIMD_UNROLL
+		for (int p = 0; p < GK_C; ++p) {
+			c0 = V_FMA(x[p], V_LOAD(b + p * ldb + j), c0);
+			c1 = V_FMA(x[p], V_LOAD(b + p * ldb + j + VEC_W), c1);
+		}
+		V_STORE(c + j, c0);
+		V_STORE(c + j + VEC_W, c1);
+	}
+	for (; j + VEC_W <= n; j += VEC_W) {
+		VEC c0 = V_ZERO();
+
+		if (beta != 0) {
+			c0 = V_MUL(V_SET1(beta), V_LOAD(c + j));
+		}
+		SIMD_UNROLL
+		for (int p = 0; p < GK_C; ++p) {
+			c0 = V_FMA(x[p], V_LOAD(b + p * ldb + j), c0);
+		}
+		V_STORE(c + j, c0);
+	}
+	for (; j < n; ++j) {
+		double value = (beta == 0) ? 0 : beta * c[j];
+
+		SIMD_UNROLL
+		for (int p = 0; p < GK_C; ++p) {
+			value += coef[p] * b[p * ldb + j];
+		}
+		c[j] = value;
+	}
+}
+
+GK_ATTR void GK_NAME(dots)(const double *a, const double *b, size_t ldb,
+	double *r, int n)
+{
+	SIMD_UNROLL
+	for (int g = 0; g < GK_C; g += GK_DOTS) {
+		const double *rowB = b + g * ldb;
+		VEC acc[GK_DOTS];
+		int j = 0;
+
+		SIMD_UNROLL
+		for (int q = 0; q < GK_DOTS; ++q) {
+			acc[q] = V_ZERO();
+		}
+		for (; j + VEC_W <= n; j += VEC_W) {
+			VEC x = V_LOAD(a + j);
+
+			SIMD_UNROLL
+			for (int q = 0; q < GK_DOTS; ++q) {
+				acc[q] = V_FMA(x, V_LOAD(rowB + q * ldb + j), acc[q]);
+			}
+		}
+		SIMD_UNROLL
+		for (int q = 0; q < GK_DOTS; ++q) {
+			double value = V_SUM(acc[q]);
+
+			for (int t = j; t < n; ++t) {
+				value += a[t] * rowB[q * ldb + t];
+			}
+			r[g + q] = value;
+		}
+	}
+}
+
+GK_ATTR void GK_NAME(update_w)(double *w, const double *vh,
+	const double *whh)
+{
+	int j = 0;
+
+	SIMD_UNROLL
+	for (; j + VEC_W <= GK_C; j += VEC_W) {
+		VEC a = V_LOAD(vh + j);
+		VEC b = V_LOAD(whh + j);
+		VEC num = V_ADD(V_POS(a), V_NEG(b));
+		VEC den = V_ADD(V_NEG(a), V_POS(b));
+		V_STORE(w + j, V_MUL(V_LOAD(w + j), V_SQRT(V_DIV(num, den))));
+	}
+	SIMD_UNROLL
+	for (; j < GK_C; ++j) {
+		double num = ((vh[j] > 0) ? vh[j] : 0) + ((whh[j] > 0) ? 0 : whh[j]);
+		double den = ((vh[j] > 0) ? 0 : vh[j]) + ((whh[j] > 0) ? whh[j] : 0);
+		w[j] = w[j] * sqrt(num / den);
+	}
+}
+
+GK_ATTR void GK_NAME(sqdiff_rows)(double *acc, const double *a,
+	size_t lda, const double *b, size_t ldb, int n)
+{
+	int j = 0;
+
+	for (; j + VEC_W <= n; j += VEC_W) {
+		VEC s = V_LOAD(acc + j);
+
+		SIMD_UNROLL
+		for (int p = 0; p < GK_C; ++p) {
+			VEC d = V_SUB(V_LOAD(a + p * lda + j), V_LOAD(b + p * ldb + j));
+			s = V_ADD(s, V_MUL(d, d));
+		}
+		V_STORE(acc + j, s);
+	}
+	for (; j < n; ++j) {
+		double s = acc[j];
+
+		SIMD_UNROLL
+		for (int p = 0; p < GK_C; ++p) {
+			double d = a[p * lda + j] - b[p * ldb + j];
+			s += d * d;
+		}
+		acc[j] = s;
+	}
+}
+
+#undef GK_DOTS
@@ -0,0 +1,34 @@
+#ifndef KERNELS_H_
+#define KERNELS_H_
+
+#include <stddef.h>
+
+/*
+ * This header contains kernels specialized for a fixed group number C.
+ * Loops over the C dimension have constant trip counts, so they are
+ * fully unrolled and their values stay in registers. Kernels exist for
+ * the group numbers listed in Kernels.c, for other group numbers the
+ * generic kernels of simd.h are used.
+ */
+
+typedef struct Group_Kernels
+{
+	int groups;	// Group number C of these kernels
+	// c = beta * c + sum of coef[p] * (row p of B), over C rows of B
+	void (*combine)(double *c, const double *coef, const double *b,
+		size_t ldb, int n, double beta);
+	// r[p] = dot product of a and row p of B, over C rows of B
+	void (*dots)(const double *a, const double *b, size_t ldb, double *r,
+		int n);
+	// w = w * sqrt((vh+ + whh-) / (vh- + whh+)), over C entries, see
+	// update_w of simd.h
+	void (*update_w)(double *w, const double *vh, const double *whh);
+	// acc += sum of (row p of A - row p of B)^2, over C rows
+	void (*sqdiff_rows)(double *acc, const double *a, size_t lda,
+		const double *b, size_t ldb, int n);
+} Group_Kernels;
+
+// Kernels for c groups and the selected instruction set, or NULL
+const Group_Kernels *group_kernels(int c);
+
+#endif
@@ -1,13 +1,203 @@
 #ifndef MATRIX_H_
 #define MATRIX_H_
 
-#define SMALL_DIM 64
+#include <stddef.h>
+#include <stdbool.h>
 
-double** multiply(double **a, int rA, double **b, int cB, int mid);
-double** sum(double **a, double **b, int r, int c);
-double** sub(double **a, double **b, int r, int c);
-double** transpose(double **a, int r, int c);
-double norm2(double **a, int r, int c);
-double norm(double **a, int r, int c);
+// Default smallest dimension for Strassen recursion, see strassen_cutoff
+#define STRASSEN_DIM 512
+// Largest inner dimension multiplied as a rank-k update
+#define MULTIPLY_RANK_K 16
+// Largest row or column number of a product multiplied as a panel
+#define MULTIPLY_PANEL 8
+// Largest side of blocks transposed by one kernel call, keeps the block
+// and its transpose in L1
+#define TRANSPOSE_TILE 32
+// Rows of A transposed by one parallel task
+#define TRANSPOSE_STRIP 256
+// Result bytes above which a transpose bypasses the caches, about the
+// size of a last level cache
+#define TRANSPOSE_STREAM (16 * 1024 * 1024)
+// Lanczos steps of spectral2() before a restart
+#define SPECTRAL_STEPS 24
+// Restarts of spectral2() before its result is accepted
+#define SPECTRAL_RESTARTS 8
+// Residual of Ritz pairs, relative to the eigenvalue, accepted by
+// spectral2()
+#define SPECTRAL_TOL 1e-10
 
-#endif
\ No newline at end of file
+// Storage types of matrix entries
+typedef enum Matrix_Type
+{
+	MATRIX_F64,	// double
+	MATRIX_F32,	// float, widened to double when read by kernels
+	MATRIX_U8,	// 8-bit codes, entry is fill or bias + scale * code
+	MATRIX_U16	// 16-bit codes, entry is fill or bias + scale * code
+} Matrix_Type;
+
+// Precision of a solver run, see matrix_factorization()
+typedef enum Precision
+{
+	PRECISION_DOUBLE,	// Double storage and arithmetic
+	PRECISION_MIXED	// Float ratings, double accumulation
+} Precision;
+
+/*
+   Dense row-major matrix descriptor.
+   All entries are stored in one contiguous buffer. A view shares the
+   buffer of its parent matrix and only differs in its dimensions and
+   offset, so sub-matrices can be described without copying.
+   Results of operations are always double. Operands may also be float
+   or quantized, they are read through MATRIX_GET() or matrix_read().
+ */
+typedef struct Matrix
+{
+	int rows;	// Number of rows
+	int cols;	// Number of columns
+	int ld;	// Leading dimension (buffer distance between two rows)
+	size_t offset;	// Buffer position of entry (0, 0)
+	bool owner;	// Whether this descriptor owns its buffer
+	double *data;	// Entries buffer of MATRIX_F64 matrices
+	Matrix_Type type;	// Storage type of entries
+	float *data32;	// Entries buffer of MATRIX_F32 matrices
+	unsigned char *data8;	// Codes buffer of MATRIX_U8 matrices
+	unsigned short *data16;	// Codes buffer of MATRIX_U16 matrices
+	double scale;	// Step between two codes of quantized matrices
+	double bias;	// Entry bias + scale * code of codes from 1 on
+	double fill;	// Entry of code 0 of quantized matrices
+} Matrix;
+
+/*
+   Buffer that hands out matrices one after another. Matrices taken from
+   an arena do not own their entries, which are all released together.
+ */
+typedef struct Arena
+{
+	double *buffer;	// Entries of all matrices
+	size_t size;	// Capacity in doubles
+	size_t used;	// Doubles handed out
+} Arena;
+
+// Precision of the current run
+extern Precision precision;
+
+// Products whose dimensions all exceed this use Strassen multiplication
+extern int strassen_cutoff;
+
+// Kernels chosen by multiply() according to the shape of a product
+typedef enum Multiply_Path
+{
+	PATH_RANK_K,	// Small inner dimension, rows of C combined from B
+	PATH_PANEL,	// Few rows or columns of C, no packing
+	PATH_BLOCKED,	// Packed blocked multiplication
+	PATH_STRASSEN,	// Strassen-Winograd over blocked multiplication
+	PATH_SYRK,	// Symmetric product of a matrix with its transpose
+	PATH_COUNT
+} Multiply_Path;
+
+// Number of products sent to every path, for diagnostics
+extern long multiply_paths[PATH_COUNT];
+// Path of the latest product
+extern Multiply_Path multiply_last_path;
+
+// Entry at row i and column j of matrix m
+#define MATRIX_AT(m, i, j) \
+	((m).data[(m).offset + (size_t)(i) * (m).ld + (j)])
+// Pointer to the first entry of row i of matrix m
+#define MATRIX_ROW(m, i) (&MATRIX_AT(m, i, 0))
+// Entry and row pointer of a MATRIX_F32 matrix
+#define MATRIX_AT32(m, i, j) \
+	((m).data32[(m).offset + (size_t)(i) * (m).ld + (j)])
+#define MATRIX_ROW32(m, i) (&MATRIX_AT32(m, i, 0))
+// Buffer position of entry (i, j), for matrices of any storage type
+#define MATRIX_POS(m, i, j) ((m).offset + (size_t)(i) * (m).ld + (j))
+// Code of an entry of a quantized matrix
+#define MATRIX_CODE(m, i, j) (((m).type == MATRIX_U8) ? \
+	(double)(m).data8[MATRIX_POS(m, i, j)] : \
+	(double)(m).data16[MATRIX_POS(m, i, j)])
+// Entry of a quantized matrix, as double
+#define MATRIX_DECODE(m, i, j) ((MATRIX_CODE(m, i, j) == 0) ? (m).fill : \
+	(m).bias + (m).scale * MATRIX_CODE(m, i, j))
+// Entry of a matrix of any storage type, as double
+#define MATRIX_GET(m, i, j) (((m).type == MATRIX_F64) ? \
+	MATRIX_AT(m, i, j) : ((m).type == MATRIX_F32) ? \
+	(double)MATRIX_AT32(m, i, j) : MATRIX_DECODE(m, i, j))
+// Stores x into an entry of a matrix of any storage type
+#define MATRIX_SET(m, i, j, x) (((m).type == MATRIX_F64) ? \
+	(void)(MATRIX_AT(m, i, j) = (x)) : ((m).type == MATRIX_F32) ? \
+	(void)(MATRIX_AT32(m, i, j) = (float)(x)) : \
+	matrix_encode(&(m), i, j, x))
+
+Matrix matrix_new(int r, int c);
+// Allocates a zero filled matrix of a storage type, see matrix_new()
+Matrix matrix_typed(int r, int c, Matrix_Type type);
+Matrix matrix_view(const Matrix *a, int r, int c, int rows, int cols);
+Matrix matrix_wrap(double *buffer, int r, int c);
+void matrix_free(Matrix *a);
+// Allocates an arena of size doubles
+Arena arena_new(size_t size);
+// Takes an uninitialized r x c matrix from an arena
+Matrix arena_matrix(Arena *arena, int r, int c);
+// Takes an uninitialized buffer of count doubles from an arena
+double *arena_take(Arena *arena, size_t count);
+// Gives back all matrices of an arena
+void arena_reset(Arena *arena);
+void arena_free(Arena *arena);
+// Changes the storage type of a matrix, which then owns a compact buffer
+void matrix_convert(Matrix *a, Matrix_Type type);
+// Reads n entries of row i from column j as doubles
+const double *matrix_read(const Matrix *a, int i, int j, int n,
+	double *buffer);
+// Sets the fill of code 0 of a quantized matrix, and the entries of its
+// other codes
+void matrix_set_range(Matrix *a, double fill, double lo, double hi,
+	bool integer);
+// Stores the code nearest to x into an entry of a quantized matrix
+void matrix_encode(Matrix *a, int i, int j, double x);
+Matrix multiply(const Matrix *a, const Matrix *b);
+// Calculates op(A)op(B) into an existing matrix R
+void matrix_multiply(Matrix *r, bool transA, bool transB, const Matrix *a,
+	const Matrix *b);
+// Calculates transpose(A) B
+Matrix multiply_tn(const Matrix *a, const Matrix *b);
+// Calculates A transpose(B)
+Matrix multiply_nt(const Matrix *a, const Matrix *b);
+// Calculates transpose(A) A
+Matrix gram_tn(const Matrix *a);
+// Calculates A transpose(A)
+Matrix gram_nt(const Matrix *a);
+// Calculates op(A[i])op(B[i]) into existing matrices C[i] for count
+// products of one shape
+void multiply_batch(bool transA, bool transB, int count, const Matrix *a,
+	const Matrix *b, Matrix *c);
+// Calculates op(A[i]) transpose(op(A[i])) into existing matrices C[i]
+// for count matrices
+void gram_batch(bool trans, int count, const Matrix *a, Matrix *c);
+Matrix sum(const Matrix *a, const Matrix *b);
+Matrix sub(const Matrix *a, const Matrix *b);
+// Elementwise operations into existing matrices, R = A + B
+void matrix_add(Matrix *r, const Matrix *a, const Matrix *b);
+// R = A - B
+void matrix_sub(Matrix *r, const Matrix *a, const Matrix *b);
+// Y = Y + alpha * X
+void matrix_axpy(Matrix *y, double alpha, const Matrix *x);
+// R = sum of coef[t] * terms[t], in one pass over R
+void matrix_combine(Matrix *r, int count, const double *coef,
+	const Matrix *const *terms);
+// Splits A into its positive and negative parts
+void matrix_split(const Matrix *a, Matrix *pos, Matrix *neg);
+Matrix transpose(const Matrix *a);
+// Transposes A into an existing matrix R
+void matrix_transpose(Matrix *r, const Matrix *a);
+double norm2(const Matrix *a);
+// Squared spectral norm, warm started from right singular vector v
+double spectral2(const Matrix *a, double *v);
+// Sum of squares of all entries
+double frobenius2(const Matrix *a);
+// Sum of products of corresponding entries of A and B
+double matrix_inner(const Matrix *a, const Matrix *b);
+double norm(const Matrix *a);
+void multiply_paths_reset();
+void multiply_paths_print();
+
+#endif
@@ -14,6 +14,12 @@ char cmd1[] = { "Please enter total number of source files" };
 char cmd2[] = { "Please enter the path of your source dataset" };
 char cmd3[] = { "Please enter number of groups" };
 char cmd4[] = { "Please enter step size alpha" };
+char cmd5[] = { "Please enter solver options, or press Enter for defaults\n"
+	"(threads=N strassen=N ratings=double|float "
+	"cost=frobenius|spectral objective=full|masked\n"
+	"solver=sequential|sources|async staleness=N)" };
+char cmd6[] = { "Please enter storage of ratings, or press Enter for double\n"
+	"(double, u16, u8 or sparse)" };
 char end[] = {"Program Finished."};
 
 #endif
\ No newline at end of file
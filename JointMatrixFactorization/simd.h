@@ -0,0 +1,87 @@
+#ifndef SIMD_H_
+#define SIMD_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Products of a batch interleaved in one vector, see lanes_syrk
+#define SIMD_LANES 8
+
+/*
+ * This header contains the vectorized kernels of hot loops. Every
+ * kernel has a scalar version, and AVX2 or AVX-512 versions are picked
+ * by simd_initialize() according to CPUID of the running processor.
+ */
+
+// Instruction sets with kernels
+typedef enum Simd_Isa
+{
+	ISA_SCALAR,
+	ISA_AVX2,
+	ISA_AVX512,
+	ISA_COUNT
+} Simd_Isa;
+
+typedef struct Simd_Kernels
+{
+	const char *name;	// Name of selected instruction set
+	Simd_Isa isa;	// Selected instruction set
+	// Micro-kernel of blocked multiplication, see Gemm.c
+	void (*gemm_kernel)(int kc, const double *a, const double *b,
+		double *c, size_t ldc, int mr, int nr, double beta);
+	// r = a + b
+	void (*add)(const double *a, const double *b, double *r, int n);
+	// r = a - b
+	void (*sub)(const double *a, const double *b, double *r, int n);
+	// y = y + alpha * x
+	void (*axpy)(double *y, double alpha, const double *x, int n);
+	// pos = positive part of a, neg = negative part of a
+	void (*split)(const double *a, double *pos, double *neg, int n);
+	// acc += (a - b)^2
+	void (*sqdiff_acc)(double *acc, const double *a, const double *b,
+		int n);
+	// w = w * sqrt((vh+ + whh-) / (vh- + whh+)), where x+ and x- are
+	// positive and negative parts of the products x
+	void (*update_w)(double *w, const double *vh, const double *whh,
+		int n);
+	// Multiplicative update of H from the products transpose(W) V and
+	// transpose(W) W H, see matrix_factorization()
+	void (*update_h)(double *h, const double *wv, const double *wwh,
+		const double *sum_h, const double *n_sum_h, double alpha,
+		double weight, int n);
+	// c = beta * c + sum of coef[p] * (row p of B), over k rows of B
+	void (*combine)(double *c, const double *coef, const double *b,
+		size_t ldb, int k, int n, double beta);
+	// c = c + sum of (coef[p] - shift) * (row index[p] of B), over k
+	// entries of a sparse row
+	void (*gather)(double *c, const double *coef, const int *index,
+		const double *b, size_t ldb, int k, int n, double shift);
+	// Dot product of a and b
+	double (*dot)(const double *a, const double *b, int n);
+	// Lower triangle of the n x n Gram products of SIMD_LANES batched
+	// matrices, acc[(i(i+1)/2 + j) lanes] += sum over p of
+	// a[(p n + i) lanes] * a[(p n + j) lanes], where a holds kb
+	// interleaved columns and lanes is SIMD_LANES
+	void (*lanes_syrk)(const double *a, int n, int kb, double *acc);
+	// r = transpose(a) for a rows x cols block. stream bypasses caches
+	// when writing r, and needs r and ldr aligned to 4 doubles
+	void (*transpose)(const double *a, size_t lda, double *r, size_t ldr,
+		int rows, int cols, bool stream);
+	// r = (double)a
+	void (*widen)(const float *a, double *r, int n);
+	// r = (float)a
+	void (*narrow)(const double *a, float *r, int n);
+	// r = fill where a is 0, bias + scale * a elsewhere, for 8-bit and
+	// 16-bit codes
+	void (*decode_u8)(const unsigned char *a, double scale, double bias,
+		double fill, double *r, int n);
+	void (*decode_u16)(const unsigned short *a, double scale, double bias,
+		double fill, double *r, int n);
+} Simd_Kernels;
+
+extern Simd_Kernels simd;
+
+// Selects kernels for the running processor
+void simd_initialize();
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef SIMD_TARGET_H_
+#define SIMD_TARGET_H_
+
+/*
+ * This header contains the compiler settings shared by files that
+ * define vectorized kernels. It is not needed by callers of kernels.
+ */
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || \
+	defined(__x86_64__)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+// Instruction sets are enabled per function, so one binary runs on all
+// processors and only calls what CPUID reports
+#if defined(SIMD_X86) && defined(__GNUC__)
+#define SIMD_AVX2 __attribute__((target("avx2,fma")))
+#define SIMD_AVX512 __attribute__((target("avx512f")))
+#define SIMD_HAS_AVX512
+#elif defined(SIMD_X86) && defined(_MSC_VER)
+#define SIMD_AVX2
+#define SIMD_AVX512
+#if _MSC_VER >= 1911
+#define SIMD_HAS_AVX512
+#endif
+#endif
+
+// Fully unrolls the next loop when its trip count is a constant
+#if defined(__GNUC__) && (__GNUC__ >= 8)
+#define SIMD_UNROLL _Pragma("GCC unroll 32")
+#else
+#define SIMD_UNROLL
+#endif
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef SPARSE_H_
+#define SPARSE_H_
+
+#include "matrix.h"
+
+/*
+ * This header contains sparse storage of ratings. Stored entries are
+ * kept both in compressed rows and in compressed columns, so that the
+ * products V transpose(H) and transpose(W) V both walk contiguous
+ * entries. Every position that is not stored holds one common entry,
+ * fill, which is what unrated entries become when ratings are
+ * rescaled. Products with dense matrices cost O(nnz C) plus a rank one
+ * term for fill, instead of O(N K C).
+ */
+
+#define SPARSE_STRIP 256	// Rows or columns of one parallel task
+
+/*
+   Sparse matrix descriptor.
+   A sparse matrix is built in two passes over its entries: positions
+   are counted with sparse_count(), then sparse_reserve() allocates the
+   entries, which are inserted with sparse_insert() in any order, and
+   sparse_finish() sorts them and builds the compressed columns.
+ */
+typedef struct Sparse
+{
+	int rows;	// Number of rows
+	int cols;	// Number of columns
+	size_t nnz;	// Number of stored entries
+	size_t *start;	// Start of every row in index and value, and nnz
+	int *index;	// Columns of stored entries, ascending in every row
+	double *value;	// Stored entries by rows
+	size_t *col_start;	// Start of every column in row_index and col_value
+	int *row_index;	// Rows of stored entries, ascending in every column
+	double *col_value;	// Stored entries by columns
+	double fill;	// Entry at every position that is not stored
+} Sparse;
+
+// Creates an empty r x c sparse matrix
+Sparse sparse_new(int r, int c);
+// Counts one stored entry in row i
+void sparse_count(Sparse *a, int i);
+// Allocates the entries counted so far
+void sparse_reserve(Sparse *a);
+// Stores x at row i and column j, later entries of a position replace
+// earlier ones
+void sparse_insert(Sparse *a, int i, int j, double x);
+// Sorts inserted entries and builds the compressed columns
+void sparse_finish(Sparse *a);
+void sparse_free(Sparse *a);
+// Calculates A transpose(B) into an existing matrix R, B is double
+void sparse_multiply_nt(Matrix *r, const Sparse *a, const Matrix *b);
+// Calculates transpose(B) A into an existing matrix R, B is double
+void sparse_multiply_tn(Matrix *r, const Matrix *b, const Sparse *a);
+// Other entries at the positions of A with fill 0, sharing positions
+Sparse sparse_pattern(const Sparse *a, double *value, double *col_value);
+// Entries of W H at the positions of A into a pattern P of A, returns
+// the squared residual of A over its stored entries
+double sparse_predict(Sparse *p, const Sparse *a, const Matrix *w,
+	const Matrix *h);
+// R = A - B, R may be B
+void sparse_sub(Matrix *r, const Sparse *a, const Matrix *b);
+// Sum of squares of all entries, including those equal to fill
+double sparse_frobenius2(const Sparse *a);
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+/*
+ * This header contains a pool of worker threads used by parallel
+ * loops. Work is split into tasks that are taken by idle workers, and
+ * the calling thread works on tasks as well.
+ */
+
+#include <stddef.h>
+
+// Body of a parallel loop. Processes tasks from begin to end - 1.
+typedef void (*Task_Func)(void *arg, int begin, int end);
+
+// Work buffers kept by every thread, see pool_scratch(). Functions that
+// are active at the same time on one thread use different slots.
+typedef enum Scratch_Slot
+{
+	SCRATCH_PACK_A,	// Packed blocks of A, interleaved columns of syrk_batch()
+	SCRATCH_PACK_B,	// Packed panels of B
+	SCRATCH_WIDE_A,	// Converted rows of A in gemm_dots()
+	SCRATCH_WIDE_B,	// Converted rows of B in gemm_rows() and gemm_dots()
+	SCRATCH_PARTIAL,	// Partial triangles of syrk() and syrk_batch()
+	SCRATCH_READ_A,	// Rows read by elementwise operations, see matrix_read()
+	SCRATCH_READ_B,
+	SCRATCH_START,	// Start vector of norm2()
+	SCRATCH_EIGEN,	// Lanczos vectors of spectral2()
+	SCRATCH_STRASSEN,	// Workspace of Strassen multiplication
+	SCRATCH_SPARSE,	// Transposed dense operand of sparse products
+	SCRATCH_COUNT
+} Scratch_Slot;
+
+// Starts workers, 0 for one thread per processor
+void pool_initialize(int threads);
+// Number of threads running parallel loops, including the caller
+int pool_threads();
+// Runs tasks 0 to count - 1 in parallel and waits for all of them
+void parallel_for(int count, Task_Func func, void *arg);
+// Work buffer of at least size bytes, owned by the calling thread
+void *pool_scratch(Scratch_Slot slot, size_t size);
+// Lock of state shared by the tasks of a parallel loop
+void pool_lock();
+void pool_unlock();
+// Waits for pool_notify() with the lock held, which is released meanwhile
+void pool_wait();
+// Wakes all tasks in pool_wait()
+void pool_notify();
+void pool_shutdown();
+
+#endif
@@ -2,6 +2,8 @@
 #define UTILITY_H_
 
 #include "preprocess.h"
+#include "matrix.h"
+#include "sparse.h"
 #include <stdio.h>
 #include <stdbool.h>
 
@@ -26,21 +28,60 @@ typedef struct Source
 	int C;	// Number of groups
 	double min;	// Minimum value of user rating
 	double max; // Maximum value of user rating
-	double **V;	// User ratings matrix
-	double **W; // Goup membership matrix
-	double **H;	// Group ratings matrix
+	Matrix V;	// User ratings matrix
+	bool sparse;	// Whether ratings are stored in R instead of V
+	Sparse R;	// User ratings in sparse storage
+	Matrix W; // Goup membership matrix
+	Matrix H;	// Group ratings matrix
 	Item *items;	// Item names
+	double normV;	// Squared Frobenius norm of rescaled V
 } Source;
 
+// Norms measuring the cost of a solver run
+typedef enum Cost_Norm
+{
+	COST_FROBENIUS,	// Squared Frobenius norms, from products of the updates
+	COST_SPECTRAL	// Squared spectral norms, from residuals
+} Cost_Norm;
+
+// Entries of V fitted by a solver run
+typedef enum Objective
+{
+	OBJECTIVE_FULL,	// All entries, unrated ones as fill
+	OBJECTIVE_MASKED	// Rated entries of sparse sources only
+} Objective;
+
+// Scheduling of the sources of a solver run
+typedef enum Solver_Mode
+{
+	SOLVER_SEQUENTIAL,	// One source after another, products in parallel
+	SOLVER_SOURCES,	// Sources in parallel, one thread each
+	SOLVER_ASYNC	// Sources in parallel without barriers, see staleness
+} Solver_Mode;
+
+// Solver settings entered before each run
+typedef struct Options
+{
+	int threads;	// Threads used by multiplications, 0 for all processors
+	int strassen;	// Dimension below which Strassen falls back to blocked
+	Precision precision;	// Storage of dense ratings
+	Cost_Norm cost;	// Norm of the cost
+	Objective objective;	// Entries of V that are fitted
+	Solver_Mode solver;	// Scheduling of sources
+	int staleness;	// Iterations asynchronous sources may run ahead
+} Options;
+
 bool check_empty(FILE *file);
 double find_number(char *str);
 double** get_reliable(Source *src, int size);
 // Find item position from Item structure
 int find_index(Item* items, char* item, int start, int end);
-void inputs_initialize(Source *src);
-void joints_initialize(Source *src, int size, int c);
-void joint_clear(Source *src, int size);
+void inputs_initialize(Source *src, Matrix_Type storage, bool sparse);
+void joints_initialize(Source *src, int size, int c, Arena *work);
+void joint_clear(Source *src, int size, Arena *work);
 void clear2D(double ***ptr, int r);
 void reset(Source *src, int size);
+void read_options(char *str, Options *opt);
+Matrix_Type read_storage(char *str, bool *sparse);
 
 #endif
\ No newline at end of file